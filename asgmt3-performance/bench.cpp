@@ -0,0 +1,517 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wordst/wordst.hpp"
+
+/**
+ * The counting logic of wordst_bad.cpp, kept line for line so its stages can
+ * be timed on their own. Only the tokenizer loop is split out of main() and
+ * the table goes to a stream instead of stdout.
+ */
+namespace bad {
+
+struct WordInfo {
+    std::vector<int> lines;
+};
+
+typedef std::map<std::string, WordInfo *> WordsStatis;
+
+typedef std::pair<std::string, WordInfo *> WordPair;
+
+typedef std::vector<WordPair> WordsVector;
+
+void statisWord(WordsStatis &wordsStatis, std::string &word, int lineNo) {
+    if (wordsStatis.find(word) == wordsStatis.end()) {
+        WordInfo *wordInfo = new WordInfo;
+        wordInfo->lines.push_back(lineNo);
+        wordsStatis[word] = wordInfo;
+    } else {
+        wordsStatis[word]->lines.push_back(lineNo);
+    }
+}
+
+bool cmp(WordPair a, WordPair b) {
+    return a.second->lines.size() > b.second->lines.size();
+}
+
+} // namespace bad
+
+/**
+ * escape_to_json() as asgmt1-style/serialize_json.cpp had it before it used
+ * escape_json(), kept as the baseline of report_escape(). On ASCII input its
+ * output is the same as escape_json()'s.
+ */
+namespace legacy {
+
+std::string escape_to_json(const std::string &s) {
+    std::ostringstream oss;
+    for (const char c : s) {
+        switch (c) {
+        case '"':
+            oss << "\\\"";
+            break;
+        case '\\':
+            oss << "\\\\";
+            break;
+        case '\b':
+            oss << "\\b";
+            break;
+        case '\f':
+            oss << "\\f";
+            break;
+        case '\n':
+            oss << "\\n";
+            break;
+        case '\r':
+            oss << "\\r";
+            break;
+        case '\t':
+            oss << "\\t";
+            break;
+        default:
+            if (std::isprint(c))
+                oss << c;  // If the character is printable, add it as is
+            else
+                oss << "\\u"  // Otherwise, output as a Unicode escape sequence
+                    << std::hex
+                    << std::setw(4)
+                    << std::setfill('0')
+                    << static_cast<unsigned>(c);
+        }
+    }
+    return oss.str();
+}
+
+} // namespace legacy
+
+/**
+ * The samples of one implementation, in milliseconds per stage and run.
+ */
+struct Series {
+    static constexpr std::array<const char *, 6> stages = {"tokenize", "insert", "get_all", "sort", "output", "total"};
+
+    std::string name;
+    std::array<std::vector<double>, stages.size()> ms;
+
+    /**
+     * Records one run from the time points taken before the first stage and
+     * after each stage.
+     */
+    auto add(const std::array<std::chrono::steady_clock::time_point, stages.size()> &points) -> void {
+        for (size_t i = 0; i + 1 < stages.size(); ++i)
+            ms[i].push_back(std::chrono::duration<double, std::milli>(points[i + 1] - points[i]).count());
+        ms.back().push_back(std::chrono::duration<double, std::milli>(points.back() - points.front()).count());
+    }
+};
+
+/**
+ * Runs the wordst_bad stages once on a file.
+ *
+ * Tokenizing reads the file with fgetc() into a vector of (word, line)
+ * tokens, which the insert stage then feeds into the std::map.
+ */
+static auto run_bad(const char *path, std::FILE *out, Series &series) -> bool {
+    std::array<std::chrono::steady_clock::time_point, Series::stages.size()> points;
+    points[0] = std::chrono::steady_clock::now();
+
+    std::FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    std::vector<std::pair<std::string, int>> tokens;
+    std::string word;
+    int lastChar = 0;
+    int curChar;
+    int lineNo = 1;
+    while ((curChar = fgetc(f)) != EOF) {
+        if (curChar == '\n')
+            lineNo++;
+        if (isalpha(curChar))
+            word += (char)tolower(curChar);
+        else if (isalpha(lastChar)) {
+            tokens.emplace_back(word, lineNo);
+            word.clear();
+        }
+        lastChar = curChar;
+    }
+    fclose(f);
+    points[1] = std::chrono::steady_clock::now();
+
+    bad::WordsStatis wordsStatis;
+    for (auto &[token, line] : tokens)
+        bad::statisWord(wordsStatis, token, line);
+    points[2] = std::chrono::steady_clock::now();
+
+    bad::WordsVector wordsVector(wordsStatis.begin(), wordsStatis.end());
+    points[3] = std::chrono::steady_clock::now();
+
+    std::sort(wordsVector.begin(), wordsVector.end(), bad::cmp);
+    points[4] = std::chrono::steady_clock::now();
+
+    fprintf(out, "WORD                 COUNT APPEARS-LINES\n");
+    for (const auto &[text, info] : wordsVector) {
+        fprintf(out, "%-20s %-5ld ", text.c_str(), info->lines.size());
+        for (size_t i = 0; i < std::min<size_t>(info->lines.size(), 20); ++i) {
+            if (i != 0)
+                fprintf(out, ",");
+            fprintf(out, "%d", info->lines[i]);
+        }
+        fprintf(out, "\n");
+    }
+    fflush(out);
+    points[5] = std::chrono::steady_clock::now();
+
+    series.add(points);
+    for (auto &entry : wordsStatis)
+        delete entry.second;
+    return true;
+}
+
+/**
+ * Runs the wordst_good stages once on a file with the given engine.
+ *
+ * Tokenizing maps the file and collects the views produced by the SIMD
+ * scanner, which the insert stage then feeds into the engine. Keeping the
+ * tokens apart costs memory a normal run does not spend, but it is what lets
+ * the two stages be timed separately.
+ */
+template <typename Engine>
+static auto run_good(const char *path, std::FILE *out, Series &series) -> bool {
+    std::array<std::chrono::steady_clock::time_point, Series::stages.size()> points;
+    points[0] = std::chrono::steady_clock::now();
+
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    MappedReader reader(fd, st.st_size);
+    close(fd);
+    if (!reader.valid() && st.st_size != 0)
+        return false;
+    std::vector<std::pair<std::string_view, std::size_t>> tokens;
+    reader.for_each_word([&](const std::string_view word, const std::size_t line) {
+        tokens.emplace_back(word, line);
+    });
+    points[1] = std::chrono::steady_clock::now();
+
+    Engine engine;
+    for (const auto &[word, line] : tokens)
+        engine.insert(word, line);
+    points[2] = std::chrono::steady_clock::now();
+
+    const auto words = engine.get_all();
+    points[3] = std::chrono::steady_clock::now();
+
+    const std::vector<size_t> order = rankStatis(words);
+    points[4] = std::chrono::steady_clock::now();
+
+    printTable(words, order, out);
+    points[5] = std::chrono::steady_clock::now();
+
+    series.add(points);
+    return true;
+}
+
+/**
+ * Compares the approximate engine with the exact one on a file, at several
+ * memory budgets.
+ *
+ * For each budget, prints how many words HeavyHitters tracks, the recall of
+ * the exact top `k` in its top `k`, the mean and the largest relative error
+ * of its counts of the exact top `k` words, where a word it does not track
+ * counts as an error of 1, and the bytes it mapped.
+ *
+ * @return false if the file can not be read.
+ */
+static auto report_accuracy(const char *path, const size_t k) -> bool {
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    MappedReader reader(fd, st.st_size);
+    close(fd);
+    if (!reader.valid() && st.st_size != 0)
+        return false;
+    std::vector<std::pair<std::string_view, std::size_t>> tokens;
+    reader.for_each_word([&](const std::string_view word, const std::size_t line) {
+        tokens.emplace_back(word, line);
+    });
+
+    HashTable exact;
+    for (const auto &[word, line] : tokens)
+        exact.insert(word, line);
+    const auto truth = exact.get_top(k);
+
+    std::cout << std::format("accuracy against the exact top {}\n", truth.size());
+    std::cout << std::format("{:<8} {:>10} {:>10} {:>10} {:>10} {:>12}\n", "BUDGET", "TRACKED", "RECALL", "MEAN-ERR", "MAX-ERR", "ENGINE-MIB");
+    for (const size_t budget : {size_t{1} << 20, size_t{4} << 20, size_t{16} << 20, size_t{64} << 20}) {
+        HeavyHitters approx(budget);
+        for (const auto &[word, line] : tokens)
+            approx.insert(word, line);
+
+        std::unordered_map<std::string, size_t> counts;
+        for (const auto &[word, info] : approx.get_all())
+            counts.emplace(word, info.count);
+        size_t found = 0;
+        for (const auto &[word, info] : approx.get_top(k))
+            found += std::any_of(truth.begin(), truth.end(), [&](const auto &entry) {
+                return entry.first == word;
+            });
+        double sum = 0, worst = 0;
+        for (const auto &[word, info] : truth) {
+            const auto it = counts.find(word);
+            const double error = it == counts.end() ? 1 : std::abs(static_cast<double>(it->second) - info.count) / info.count;
+            sum += error, worst = std::max(worst, error);
+        }
+        const size_t n = std::max<size_t>(truth.size(), 1);
+        std::cout << std::format("{:<8} {:>10} {:>10.4f} {:>10.2e} {:>10.2e} {:>12.1f}\n", std::format("{}M", budget >> 20), approx.census().words,
+                                 static_cast<double>(found) / n, sum / n, worst, approx.memory().reserved / 1048576.0);
+    }
+    return true;
+}
+
+/**
+ * Returns the p-th percentile of the samples by the nearest-rank method; the
+ * median is taken as the mean of the two middle samples.
+ */
+static auto percentile(std::vector<double> samples, const double p) -> double {
+    std::sort(samples.begin(), samples.end());
+    if (p == 50)
+        return (samples[(samples.size() - 1) / 2] + samples[samples.size() / 2]) / 2;
+    const size_t rank = static_cast<size_t>(std::ceil(p / 100 * samples.size()));
+    return samples[std::max<size_t>(rank, 1) - 1];
+}
+
+/**
+ * Measures JSON string escaping on payloads cut from a file, in GB/s of
+ * input.
+ *
+ * The payloads are the lines of the file, one string each with its '\n',
+ * as a log shipper escapes them; its words, the strings of a
+ * `--format=json` report; and the lines again as a JSON document with one
+ * `{"line":...,"text":...}` object per line, escaped once more as a string
+ * each, which is dense in quotes and backslashes. At most 16 MiB of the file
+ * is used and bytes 0x80 and above are dropped, since legacy::escape_to_json()
+ * turns them into invalid escapes. Every payload is escaped by the legacy
+ * function and by escape_json() into a reused std::string with every kernel
+ * the CPU supports; the outputs are checked to be byte-identical before the
+ * median of `repeat` timed runs is printed.
+ *
+ * @return false if the file can not be read or an output differs.
+ */
+static auto report_escape(const char *path, const size_t repeat) -> bool {
+    std::FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+    std::string text(size_t{16} << 20, '\0');
+    text.resize(fread(text.data(), 1, text.size(), fp));
+    fclose(fp);
+    std::erase_if(text, [](const char c) {
+        return static_cast<unsigned char>(c) >= 0x80;
+    });
+
+    std::vector<std::string> document{text}, lines, words, nested;
+    for (size_t begin = 0, end; begin < text.size(); begin = end) {
+        end = std::min(text.find('\n', begin), text.size() - 1) + 1;
+        lines.push_back(text.substr(begin, end - begin));
+    }
+    for (size_t begin = 0; begin < text.size();) {
+        const size_t end = std::find_if_not(text.begin() + begin, text.end(), simd::is_letter) - text.begin();
+        if (end > begin)
+            words.push_back(text.substr(begin, end - begin));
+        begin = end + (end == begin);
+    }
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::string object;
+        StringSink sink{object};
+        JsonWriter json(sink);
+        json.begin_object();
+        json.key("line");
+        json.value(i + 1);
+        json.key("text");
+        json.value(lines[i]);
+        json.end_object();
+        nested.push_back(std::move(object));
+    }
+
+    std::vector<std::pair<const char *, simd::kernel_t>> kernels{{"scalar", simd::kernel_t::scalar}};
+    if (simd::detect_kernel() >= simd::kernel_t::sse2)
+        kernels.emplace_back("sse2", simd::kernel_t::sse2);
+    if (simd::detect_kernel() >= simd::kernel_t::avx2)
+        kernels.emplace_back("avx2", simd::kernel_t::avx2);
+    const simd::kernel_t chosen = simd::kernel;
+
+    std::cout << std::format("json escape, median of {} runs\n", repeat);
+    std::cout << std::format("{:<8} {:<8} {:>10} {:>8}\n", "PAYLOAD", "IMPL", "MIB", "GB/S");
+    bool same = true;
+    for (const auto &[name, payload] : {std::pair{"document", &document}, {"lines", &lines}, {"words", &words}, {"nested", &nested}}) {
+        size_t bytes = 0;
+        std::string expected;
+        for (const std::string &str : *payload)
+            bytes += str.size(), expected += legacy::escape_to_json(str);
+
+        const auto time = [&](const char *impl, auto &&escape) {
+            std::vector<double> seconds;
+            for (size_t run = 0; run < repeat; ++run) {
+                const auto start = std::chrono::steady_clock::now();
+                size_t written = 0;
+                for (const std::string &str : *payload)
+                    written += escape(str);
+                seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                if (written != expected.size())
+                    same = false;
+            }
+            std::cout << std::format("{:<8} {:<8} {:>10.1f} {:>8.2f}\n", name, impl, bytes / 1048576.0, bytes / 1e9 / std::max(percentile(seconds, 50), 1e-9));
+        };
+        time("legacy", [](const std::string &str) {
+            return legacy::escape_to_json(str).size();
+        });
+        for (const auto &[impl, kernel] : kernels) {
+            simd::kernel = kernel;
+            std::string out, all;
+            for (const std::string &str : *payload) {
+                StringSink sink{all};
+                escape_json(sink, str);
+            }
+            same &= all == expected;
+            time(impl, [&](const std::string &str) {
+                out.clear();
+                StringSink sink{out};
+                escape_json(sink, str);
+                return out.size();
+            });
+        }
+        std::vector<char> buffer(max_escaped_size(std::max_element(payload->begin(), payload->end(), [](const std::string &a, const std::string &b) {
+                                                      return a.size() < b.size();
+                                                  })->size()));
+        time("buffer", [&](const std::string &str) {
+            return static_cast<size_t>(escape_json(buffer.data(), str) - buffer.data());
+        });
+        simd::kernel = chosen;
+    }
+    return same;
+}
+
+static constexpr const char *usage =
+    "Usage: {0} [--repeat N] [--warmup N] [--top K] filename\n"
+    "  --repeat N   timed runs per implementation, 5 by default\n"
+    "  --warmup N   untimed runs before them, 1 by default\n"
+    "  --top K      words to check the approximate engine on, 100 by default";
+
+/**
+ * Times each stage of wordst_bad and wordst_good on a file.
+ *
+ * Every implementation (wordst_bad, wordst_good with the Trie, the
+ * HashTable and HeavyHitters at its default budget) is run `--warmup` times
+ * untimed and `--repeat` times timed, one implementation after the other.
+ * The median and the 95th percentile of every stage are printed, in
+ * milliseconds, with the throughput of the whole run at its median. Tables
+ * are written to /dev/null, so the output stage measures formatting and the
+ * write system calls only. The accuracy of HeavyHitters against the exact
+ * counts follows, see report_accuracy(), and the throughput of JSON string
+ * escaping, see report_escape().
+ *
+ * @param argc The number of arguments passed to the program.
+ * @param argv The array of arguments passed to the program.
+ * @return 0 if the program runs successfully, 1 otherwise.
+ */
+int main(int argc, const char *argv[]) {
+    size_t repeat = 5, warmup = 1, top = 100;
+    const char *filename = nullptr;
+    bool ok = true;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--repeat" && i + 1 < argc)
+            repeat = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--warmup" && i + 1 < argc)
+            warmup = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--top" && i + 1 < argc)
+            top = std::strtoull(argv[++i], nullptr, 10);
+        else if (!filename && !arg.starts_with("-"))
+            filename = argv[i];
+        else
+            ok = false;
+    }
+    if (!ok || !filename || repeat == 0) {
+        std::cerr
+            << std::format(usage, argv[0])
+            << std::endl;
+        return 1;
+    }
+
+    std::FILE *out = fopen("/dev/null", "w");
+    struct stat st;
+    if (!out || stat(filename, &st) != 0) {
+        std::cerr
+            << std::format("can not open file {}", filename)
+            << std::endl;
+        return 1;
+    }
+
+    std::vector<Series> results;
+    const auto measure = [&](const char *name, auto &&run) -> bool {
+        Series series{name, {}};
+        for (size_t i = 0; i < warmup + repeat; ++i) {
+            if (!run(filename, out, series))
+                return false;
+            if (i < warmup)
+                series = Series{name, {}};
+        }
+        results.push_back(std::move(series));
+        return true;
+    };
+    if (!measure("bad", run_bad) || !measure("good/trie", run_good<Trie>) || !measure("good/hash", run_good<HashTable>) ||
+        !measure("good/approx", run_good<HeavyHitters>)) {
+        std::cerr
+            << std::format("can not open file {}", filename)
+            << std::endl;
+        return 1;
+    }
+
+    std::cout << std::format("{} bytes, {} runs after {} warmup\n", st.st_size, repeat, warmup);
+    std::cout << std::format("{:<12} {:<10} {:>12} {:>12}\n", "IMPL", "STAGE", "MEDIAN-MS", "P95-MS");
+    for (const Series &series : results)
+        for (size_t i = 0; i < Series::stages.size(); ++i)
+            std::cout << std::format("{:<12} {:<10} {:>12.2f} {:>12.2f}\n", series.name, Series::stages[i], percentile(series.ms[i], 50), percentile(series.ms[i], 95));
+    for (const Series &series : results) {
+        const double seconds = percentile(series.ms.back(), 50) / 1000;
+        std::cout << std::format("{:<12} {:.1f} MiB/s\n", series.name, st.st_size / 1048576.0 / std::max(seconds, 1e-9));
+    }
+    if (!report_accuracy(filename, top)) {
+        std::cerr
+            << std::format("can not open file {}", filename)
+            << std::endl;
+        return 1;
+    }
+    if (!report_escape(filename, repeat)) {
+        std::cerr
+            << std::format("can not compare JSON escaping on {}", filename)
+            << std::endl;
+        return 1;
+    }
+    return 0;
+}
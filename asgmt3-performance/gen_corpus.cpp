@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * A deterministic random source.
+ *
+ * std::mt19937_64 is fully specified by the standard, but the std::*_distribution
+ * classes are not, so the values are drawn by hand to give the same corpus
+ * with every standard library.
+ */
+class Random {
+    std::mt19937_64 engine;
+
+  public:
+    explicit Random(const std::uint64_t seed) : engine(seed) {}
+
+    /**
+     * Draws an integer in [0, n).
+     */
+    auto below(const std::uint64_t n) -> std::uint64_t {
+        return engine() % n;
+    }
+
+    /**
+     * Draws a double in [0, 1) with 53 random bits.
+     */
+    auto unit(void) -> double {
+        return (engine() >> 11) * 0x1.0p-53;
+    }
+};
+
+/**
+ * Builds `vocab` distinct lowercase words.
+ *
+ * Lengths follow a rough English shape: mostly 3 to 8 letters, sometimes up
+ * to 14, and a few longer than the 20 columns of the WORD field.
+ *
+ * @param random The random source.
+ * @param vocab The number of words.
+ * @return The words, the most frequent rank first.
+ */
+static auto make_vocabulary(Random &random, const std::size_t vocab) -> std::vector<std::string> {
+    std::vector<std::string> words;
+    std::unordered_set<std::string> seen;
+    words.reserve(vocab);
+    while (words.size() < vocab) {
+        const std::uint64_t shape = random.below(100);
+        const std::size_t length = shape < 85 ? 3 + random.below(6) : shape < 99 ? 1 + random.below(14) : 21 + random.below(8);
+        std::string word(length, 'a');
+        for (char &c : word)
+            c = 'a' + random.below(26);
+        if (seen.insert(word).second)
+            words.push_back(std::move(word));
+    }
+    return words;
+}
+
+/**
+ * Parses a byte count such as `64M`, with an optional K, M or G suffix.
+ */
+static auto parse_size(const char *arg) -> std::optional<std::size_t> {
+    char *end;
+    const unsigned long long value = std::strtoull(arg, &end, 10);
+    const std::string_view suffix(end);
+    if (end == arg)
+        return std::nullopt;
+    if (suffix.empty())
+        return value;
+    if (suffix == "K" || suffix == "k")
+        return value << 10;
+    if (suffix == "M" || suffix == "m")
+        return value << 20;
+    if (suffix == "G" || suffix == "g")
+        return value << 30;
+    return std::nullopt;
+}
+
+static constexpr const char *usage =
+    "Usage: {0} [--seed S] size vocab skew\n"
+    "  size    bytes to write to stdout, with an optional K, M or G suffix\n"
+    "  vocab   number of distinct words\n"
+    "  skew    Zipf exponent s; word of rank r is drawn with weight 1 / r^s";
+
+/**
+ * Writes a synthetic text with a Zipf word distribution to stdout.
+ *
+ * The same arguments always produce the same bytes. Words are separated by
+ * spaces and the occasional comma or period, lines hold 4 to 15 words, and
+ * about one word in ten is capitalized so the tokenizer's case folding is
+ * exercised. Output stops at the first line end at or past `size` bytes.
+ *
+ * @param argc The number of arguments passed to the program.
+ * @param argv The array of arguments passed to the program.
+ * @return 0 if the program runs successfully, 1 otherwise.
+ */
+int main(int argc, const char *argv[]) {
+    std::uint64_t seed = 1;
+    std::vector<const char *> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--seed" && i + 1 < argc)
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        else
+            positional.push_back(argv[i]);
+    }
+
+    const std::optional<std::size_t> size = positional.size() == 3 ? parse_size(positional[0]) : std::nullopt;
+    const std::size_t vocab = positional.size() == 3 ? std::strtoull(positional[1], nullptr, 10) : 0;
+    const double skew = positional.size() == 3 ? std::strtod(positional[2], nullptr) : -1;
+    if (!size || vocab == 0 || skew < 0) {
+        std::cerr
+            << std::format(usage, argv[0])
+            << std::endl;
+        return 1;
+    }
+
+    Random random(seed);
+    const std::vector<std::string> words = make_vocabulary(random, vocab);
+
+    std::vector<double> cumulative(vocab);
+    double total = 0;
+    for (std::size_t r = 0; r < vocab; ++r)
+        cumulative[r] = total += std::pow(static_cast<double>(r + 1), -skew);
+
+    std::string out;
+    out.reserve(1 << 20);
+    std::size_t written = 0;
+    while (written + out.size() < *size) {
+        const std::size_t per_line = 4 + random.below(12);
+        for (std::size_t i = 0; i < per_line; ++i) {
+            const double u = random.unit() * total;
+            const std::size_t r = std::min<std::size_t>(std::upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin(), vocab - 1);
+            const std::size_t start = out.size();
+            out += words[r];
+            if (random.below(10) == 0)
+                out[start] -= 'a' - 'A';
+            if (i + 1 < per_line) {
+                const std::uint64_t sep = random.below(20);
+                out += sep == 0 ? ", " : sep == 1 ? ". " : " ";
+            }
+        }
+        out += random.below(8) == 0 ? ".\n" : "\n";
+
+        if (out.size() >= (1 << 20)) {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            written += out.size();
+            out.clear();
+        }
+    }
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    return std::ferror(stdout) ? 1 : 0;
+}
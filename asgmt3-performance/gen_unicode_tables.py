@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Generates wordst/unicode_tables.hpp, the lookup tables of `wordst_good --utf8`.
+
+Usage: python3 gen_unicode_tables.py > wordst/unicode_tables.hpp
+
+The tables come from the unicodedata module, so they follow the Unicode
+version of the Python that runs this script. Both are two-stage tables: the
+high bits of a code point pick a block, the low bits an entry in it, and
+identical blocks are stored once.
+
+- properties: per code point, bit 0 is set for word characters (general
+  categories L* and M*, so combining marks stay inside their word), bit 1 for
+  zero-width characters (Mn, Me, Cf) and bit 2 for wide ones (East Asian
+  Width W or F).
+- fold: per code point, the signed distance to its simple case folding
+  (CaseFolding.txt statuses C and S), which is the single-code-point
+  casefold() where there is one and the single-code-point lower() otherwise.
+"""
+
+import sys
+import unicodedata
+
+LIMIT = 0x110000
+PROPERTY_SHIFT = 8
+FOLD_SHIFT = 7
+
+
+def properties(cp):
+    ch = chr(cp)
+    category = unicodedata.category(ch)
+    bits = 0
+    if category[0] in "LM":
+        bits |= 1
+    if category in ("Mn", "Me", "Cf"):
+        bits |= 2
+    if unicodedata.east_asian_width(ch) in ("W", "F"):
+        bits |= 4
+    return bits
+
+
+def fold(cp):
+    ch = chr(cp)
+    folded = ch.casefold()
+    if len(folded) != 1:
+        folded = ch.lower()
+    if len(folded) != 1:
+        return 0
+    return ord(folded) - cp
+
+
+def two_stage(values, shift):
+    size = 1 << shift
+    blocks, index, seen = [], [], {}
+    for start in range(0, LIMIT, size):
+        block = tuple(values[start:start + size])
+        if block not in seen:
+            seen[block] = len(blocks)
+            blocks.append(block)
+        index.append(seen[block])
+    return index, blocks
+
+
+def emit_array(out, ctype, name, rows, per_line):
+    out.write(f"inline constexpr {ctype} {name} = {{\n")
+    for row in rows:
+        for i in range(0, len(row), per_line):
+            out.write("    " + ", ".join(str(v) for v in row[i:i + per_line]) + ",\n")
+    out.write("};\n\n")
+
+
+def main():
+    property_index, property_blocks = two_stage([properties(cp) for cp in range(LIMIT)], PROPERTY_SHIFT)
+    fold_index, fold_blocks = two_stage([fold(cp) for cp in range(LIMIT)], FOLD_SHIFT)
+    assert len(property_blocks) <= 256 and len(fold_blocks) <= 256
+
+    out = sys.stdout
+    out.write("// Generated by gen_unicode_tables.py from Unicode "
+              f"{unicodedata.unidata_version}; do not edit.\n")
+    out.write("#pragma once\n\n#include <cstdint>\n\nnamespace unicode {\n\n")
+    out.write(f"inline constexpr unsigned property_shift = {PROPERTY_SHIFT};\n")
+    out.write(f"inline constexpr unsigned fold_shift = {FOLD_SHIFT};\n\n")
+    emit_array(out, "std::uint8_t", f"property_index[{len(property_index)}]", [property_index], 32)
+    emit_array(out, "std::uint8_t", f"property_blocks[{len(property_blocks)} << property_shift]", property_blocks, 32)
+    emit_array(out, "std::uint8_t", f"fold_index[{len(fold_index)}]", [fold_index], 32)
+    emit_array(out, "std::int32_t", f"fold_blocks[{len(fold_blocks)} << fold_shift]", fold_blocks, 16)
+    out.write("} // namespace unicode\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "hash_table.hpp"
+#include "word_info.hpp"
+
+/**
+ * The memory budget of an approximate engine in bytes, set by `--approx`.
+ */
+inline std::size_t approx_budget = std::size_t{64} << 20;
+
+/**
+ * Approximate counting engine that fits a fixed memory budget however many
+ * distinct words the input has: a Count-Min Sketch estimates the count of
+ * every word and a Space-Saving summary keeps the most frequent ones.
+ *
+ * Half of the budget holds the sketch, `depth` rows of `width` counters. A
+ * word raises one counter per row, and only those below its new estimate
+ * (conservative update). The estimate, the smallest of the word's counters,
+ * never undercounts and, with N the number of words counted, overcounts by
+ * more than e / width * N with probability at most e^-depth.
+ *
+ * The other half holds the summary of `capacity` tracked words. A tracked
+ * word's count is an upper bound on its true count and its count minus its
+ * error a lower bound. A word that is not tracked takes the place of the one
+ * with the smallest count when the summary is full, and inherits that count
+ * plus one as its count and that count as its error. Every word that occurs
+ * more than N / capacity times is tracked, and no error exceeds
+ * N / capacity. The reported count of a tracked word is the smaller of its
+ * count and its sketch estimate, so it is an upper bound with the error of
+ * whichever is tighter.
+ *
+ * With the 64 MiB default, the sketch has 2^20 counters per row, so
+ * estimates are within 2.6e-6 * N with probability 98%, and the summary
+ * tracks about 400,000 words, so errors stay below 2.5e-6 * N.
+ *
+ * A tracked word records one line, the line where it started to be tracked,
+ * which is its first occurrence when its error is 0. Words longer than
+ * `key_bytes` are counted by the sketch but never tracked.
+ */
+template <bool Utf8>
+class BasicHeavyHitters {
+  public:
+    static constexpr std::size_t depth = 4;
+    static constexpr std::size_t key_bytes = 31;
+
+  private:
+    /**
+     * A tracked word, one 64-byte cache line.
+     *
+     * `first` is the recorded line, 0 for none. `hash` keeps the low 32 bits
+     * of the word's hash, which pick its home slot, and `heap` is its position
+     * in the min-heap. The lowercase word is stored in place.
+     */
+    struct entry_t {
+        std::uint64_t count;
+        std::uint64_t error;
+        std::uint64_t first;
+        std::uint32_t hash;
+        std::uint32_t heap;
+        std::uint8_t length;
+        char word[key_bytes];
+    };
+
+    static_assert(sizeof(entry_t) == 64, "an entry is one cache line");
+
+    /**
+     * Bytes of the summary per tracked word: the entry, its heap position
+     * and up to four linear-probing slots.
+     */
+    static constexpr std::size_t entry_bytes = sizeof(entry_t) + 5 * sizeof(std::uint32_t);
+
+    std::size_t width;
+    std::size_t capacity;
+    std::size_t total = 0;
+    std::uint64_t evicted = 0;
+    Arena<std::uint64_t> cells;
+    Arena<entry_t> entries;
+    std::vector<std::uint32_t> slots;
+    std::uint32_t mask;
+    std::vector<std::uint32_t> heap;
+
+    static auto fold(const char ch) -> char {
+        return Utf8 && static_cast<unsigned char>(ch - 'A') >= 26 ? ch : ch | 0x20;
+    }
+
+    /**
+     * The counter of a hash in row `row`. The rows index the sketch with
+     * h1 + row * h2, both taken from the one 64-bit hash.
+     */
+    auto cell(const std::uint64_t h, const std::size_t row) const -> std::size_t {
+        return row * width + ((h + row * ((h >> 32) | 1)) & (width - 1));
+    }
+
+    /**
+     * Counts an occurrence in the sketch.
+     */
+    auto raise(const std::uint64_t h) -> void {
+        std::size_t at[depth];
+        std::uint64_t estimate = UINT64_MAX;
+        for (std::size_t row = 0; row < depth; ++row) {
+            at[row] = cell(h, row);
+            estimate = std::min(estimate, cells[at[row]]);
+        }
+        ++estimate;
+        for (std::size_t row = 0; row < depth; ++row)
+            cells[at[row]] = std::max(cells[at[row]], estimate);
+    }
+
+    auto estimate(const std::uint64_t h) const -> std::uint64_t {
+        std::uint64_t estimate = UINT64_MAX;
+        for (std::size_t row = 0; row < depth; ++row)
+            estimate = std::min(estimate, cells[cell(h, row)]);
+        return estimate;
+    }
+
+    /**
+     * Finds the slot of a lowercase word, or the empty slot where it would go.
+     */
+    auto find(const std::uint32_t hash, const char *key, const std::size_t length) const -> std::uint32_t {
+        std::uint32_t pos = hash & mask;
+        for (; slots[pos]; pos = (pos + 1) & mask) {
+            const entry_t &entry = entries[slots[pos] - 1];
+            if (entry.hash == hash && entry.length == length && !std::memcmp(entry.word, key, length))
+                break;
+        }
+        return pos;
+    }
+
+    /**
+     * Removes a tracked word from the slots, shifting the slots after it
+     * back so no lookup is cut short by the hole.
+     */
+    auto erase(const std::uint32_t id) -> void {
+        std::uint32_t pos = entries[id].hash & mask;
+        while (slots[pos] != id + 1)
+            pos = (pos + 1) & mask;
+        for (std::uint32_t next = (pos + 1) & mask; slots[next]; next = (next + 1) & mask) {
+            const std::uint32_t home = entries[slots[next] - 1].hash & mask;
+            if (((next - home) & mask) >= ((next - pos) & mask)) {
+                slots[pos] = slots[next];
+                pos = next;
+            }
+        }
+        slots[pos] = 0;
+    }
+
+    auto place(const std::size_t i, const std::uint32_t id) -> void {
+        heap[i] = id;
+        entries[id].heap = i;
+    }
+
+    auto sift_up(std::size_t i) -> void {
+        const std::uint32_t id = heap[i];
+        for (; i && entries[heap[(i - 1) / 2]].count > entries[id].count; i = (i - 1) / 2)
+            place(i, heap[(i - 1) / 2]);
+        place(i, id);
+    }
+
+    auto sift_down(std::size_t i) -> void {
+        const std::uint32_t id = heap[i];
+        for (std::size_t child; (child = 2 * i + 1) < heap.size(); i = child) {
+            if (child + 1 < heap.size() && entries[heap[child + 1]].count < entries[heap[child]].count)
+                ++child;
+            if (entries[heap[child]].count >= entries[id].count)
+                break;
+            place(i, heap[child]);
+        }
+        place(i, id);
+    }
+
+    /**
+     * The reported count and line of a tracked word.
+     */
+    auto info(const entry_t &entry) const -> WordInfo {
+        const std::uint64_t bound = estimate(BasicHashTable<Utf8>::hash(std::string_view(entry.word, entry.length)));
+        WordInfo info{std::min(entry.count, bound), {}};
+        if (entry.first)
+            info.lines.push_back(entry.first);
+        return info;
+    }
+
+  public:
+    /**
+     * Constructor for the BasicHeavyHitters class, with the budget set by
+     * `--approx`.
+     */
+    BasicHeavyHitters() : BasicHeavyHitters(approx_budget) {}
+
+    /**
+     * Splits a memory budget between the sketch and the summary. The
+     * sketch's counters are mapped up front but cost memory only as they are
+     * touched; the summary grows up to its capacity.
+     *
+     * @param budget The budget in bytes, at least a few KiB.
+     */
+    explicit BasicHeavyHitters(const std::size_t budget) {
+        width = std::bit_floor(std::max<std::size_t>(budget / 2 / (depth * sizeof(std::uint64_t)), 64));
+        capacity = std::max<std::size_t>(budget / 2 / entry_bytes, 16);
+        slots.assign(std::bit_ceil(2 * capacity), 0);
+        mask = slots.size() - 1;
+        cells.reserve(width * depth);
+        for (std::size_t i = 0; i < width * depth; i += cells.per_chunk)
+            cells.allocate(std::min(cells.per_chunk, width * depth - i));
+    }
+
+    BasicHeavyHitters(BasicHeavyHitters &&) = default;
+    auto operator=(BasicHeavyHitters &&) -> BasicHeavyHitters & = default;
+
+    /**
+     * Does nothing: the budget, not the input, sizes the engine.
+     */
+    auto reserve(const size_t) -> void {}
+
+    /**
+     * Reports the bytes the sketch and the summary use, which stay within
+     * the budget; the arenas round them up to whole chunks of address
+     * space. Nothing is ever copied to grow them.
+     */
+    auto memory(void) const -> MemoryStats {
+        const std::size_t summary = entries.size() * sizeof(entry_t) + (slots.capacity() + heap.capacity()) * sizeof(std::uint32_t);
+        return MemoryStats{width * depth * sizeof(std::uint64_t) + summary, 0};
+    }
+
+    /**
+     * Counts the tracked words, every word occurrence and the sketch
+     * counters. See Trie::census().
+     */
+    auto census(void) const -> Census {
+        return Census{entries.size(), total, width * depth, 0};
+    }
+
+    /**
+     * The largest count a word that is not tracked can have.
+     */
+    auto untracked_bound(void) const -> std::size_t {
+        return evicted;
+    }
+
+    /**
+     * Counts a word occurrence.
+     *
+     * Letters are folded to lowercase as by the other engines. The sketch
+     * always counts the word; the summary counts it if it is tracked and
+     * otherwise starts tracking it, recording `line` if `Cap` is not 0.
+     *
+     * @param word The letters of the word.
+     * @param line The line number where the word occurs.
+     * @tparam Cap The number of lines to record, see WordInfo::add().
+     */
+    template <std::size_t Cap = dynamic_lines>
+    auto insert(const std::string_view word, const size_t line) -> void {
+        ++total;
+        const std::uint64_t h = BasicHashTable<Utf8>::hash(word);
+        raise(h);
+        if (word.size() > key_bytes)
+            return;
+
+        char key[key_bytes];
+        for (std::size_t i = 0; i < word.size(); ++i)
+            key[i] = fold(word[i]);
+        std::uint32_t pos = find(h, key, word.size());
+        if (slots[pos]) {
+            entry_t &entry = entries[slots[pos] - 1];
+            ++entry.count;
+            sift_down(entry.heap);
+            return;
+        }
+
+        std::uint32_t id;
+        const bool fresh = entries.size() < capacity;
+        if (fresh) {
+            id = entries.push_back(entry_t{});
+            heap.push_back(id);
+            entries[id].heap = heap.size() - 1;
+        } else {
+            id = heap.front();
+            erase(id);
+            evicted = std::max(evicted, entries[id].count);
+            pos = find(h, key, word.size());
+        }
+        entry_t &entry = entries[id];
+        entry.count = fresh ? 1 : evicted + 1;
+        entry.error = fresh ? 0 : evicted;
+        entry.first = (Cap == dynamic_lines ? max_lines : Cap) ? line : 0;
+        entry.hash = h;
+        entry.length = word.size();
+        std::memcpy(entry.word, key, word.size());
+        slots[pos] = id + 1;
+        if (fresh)
+            sift_up(entry.heap);
+        else
+            sift_down(entry.heap);
+    }
+
+    /**
+     * Adds a constant to every recorded line number. See Trie::shift_lines().
+     *
+     * @param offset The number of lines before the chunk.
+     */
+    auto shift_lines(const size_t offset) -> void {
+        for (std::size_t id = 0; id < entries.size(); ++id)
+            if (entries[id].first)
+                entries[id].first += offset;
+    }
+
+    /**
+     * Merges the counts of another engine with the same budget, which
+     * covers later input, into this one.
+     *
+     * The sketches are added counter by counter. A word tracked on both
+     * sides adds its counts and errors; a word tracked on one side only adds
+     * the most the other side can have counted without tracking it, to both.
+     * The `capacity` largest counts are kept. Counts stay upper bounds and
+     * counts minus errors lower bounds, but the N / capacity guarantee only
+     * holds for each engine before the merge.
+     *
+     * @param other The engine to merge; it is left unchanged.
+     */
+    auto merge(const BasicHeavyHitters &other) -> void {
+        for (std::size_t i = 0; i < width * depth; ++i)
+            cells[i] += other.cells[i];
+        total += other.total;
+
+        std::vector<entry_t> merged;
+        merged.reserve(entries.size() + other.entries.size());
+        for (std::size_t id = 0; id < entries.size(); ++id) {
+            entry_t entry = entries[id];
+            const std::uint32_t pos = other.find(entry.hash, entry.word, entry.length);
+            const std::uint64_t count = other.slots[pos] ? other.entries[other.slots[pos] - 1].count : other.evicted;
+            entry.count += count;
+            entry.error += other.slots[pos] ? other.entries[other.slots[pos] - 1].error : count;
+            merged.push_back(entry);
+        }
+        for (std::size_t id = 0; id < other.entries.size(); ++id) {
+            entry_t entry = other.entries[id];
+            if (slots[find(entry.hash, entry.word, entry.length)])
+                continue;
+            entry.count += evicted;
+            entry.error += evicted;
+            merged.push_back(entry);
+        }
+
+        evicted += other.evicted;
+        if (merged.size() > capacity) {
+            std::nth_element(merged.begin(), merged.begin() + capacity, merged.end(), [](const entry_t &a, const entry_t &b) {
+                return a.count != b.count ? a.count > b.count : std::string_view(a.word, a.length) < std::string_view(b.word, b.length);
+            });
+            for (auto it = merged.begin() + capacity; it != merged.end(); ++it)
+                evicted = std::max(evicted, it->count);
+            merged.resize(capacity);
+        }
+
+        entries = Arena<entry_t>();
+        std::fill(slots.begin(), slots.end(), 0);
+        heap.resize(merged.size());
+        for (const entry_t &entry : merged) {
+            const std::uint32_t id = entries.push_back(entry);
+            slots[find(entry.hash, entry.word, entry.length)] = id + 1;
+            place(id, id);
+        }
+        for (std::size_t i = heap.size() / 2; i-- > 0;)
+            sift_down(i);
+    }
+
+    /**
+     * Retrieves the tracked words in lexicographic order, as the exact
+     * engines do, each with its estimated count and recorded line.
+     *
+     * @return A vector of pairs containing each word and its WordInfo.
+     */
+    auto get_all(void) const -> std::vector<std::pair<std::string, WordInfo>> {
+        std::vector<std::uint32_t> order(entries.size());
+        for (std::uint32_t id = 0; id < order.size(); ++id)
+            order[id] = id;
+        const auto word = [&](const std::uint32_t id) {
+            return std::string_view(entries[id].word, entries[id].length);
+        };
+        std::sort(order.begin(), order.end(), [&](const std::uint32_t a, const std::uint32_t b) {
+            return word(a) < word(b);
+        });
+
+        std::vector<std::pair<std::string, WordInfo>> result;
+        result.reserve(order.size());
+        for (const std::uint32_t id : order)
+            result.emplace_back(word(id), info(entries[id]));
+        return result;
+    }
+
+    /**
+     * Retrieves the `k` tracked words with the largest counts, best first.
+     * See Trie::get_top().
+     *
+     * @param k The number of words to return.
+     * @return Up to `k` pairs of a word and its WordInfo.
+     */
+    auto get_top(const size_t k) const -> std::vector<std::pair<std::string, WordInfo>> {
+        std::vector<WordInfo> infos;
+        infos.reserve(entries.size());
+        for (std::size_t id = 0; id < entries.size(); ++id)
+            infos.push_back(info(entries[id]));
+        TopK top(k, entries.size());
+        for (std::size_t id = 0; id < entries.size(); ++id)
+            top.offer(std::string_view(entries[id].word, entries[id].length), infos[id]);
+        return top.take();
+    }
+};
+
+using HeavyHitters = BasicHeavyHitters<false>;
+using Utf8HeavyHitters = BasicHeavyHitters<true>;
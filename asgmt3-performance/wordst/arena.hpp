@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+/**
+ * Bytes an engine has mapped for its tables and bytes it has copied while
+ * growing them.
+ */
+struct MemoryStats {
+    std::size_t reserved;
+    std::size_t copied;
+};
+
+/**
+ * What an engine holds: distinct words, word occurrences, table entries
+ * (trie nodes or hash slots) and heap bytes of line lists that outgrew
+ * their WordInfo.
+ */
+struct Census {
+    std::size_t words;
+    std::size_t tokens;
+    std::size_t nodes;
+    std::size_t postings;
+};
+
+/**
+ * Whether new arena chunks are aligned to 2 MiB and advised with
+ * MADV_HUGEPAGE, so that each one can be backed by a single transparent
+ * hugepage.
+ */
+inline bool arena_hugepages = false;
+
+/**
+ * A growable array of trivially copyable elements stored in 2 MiB chunks.
+ *
+ * Unlike std::vector, growing never moves existing elements: a new chunk is
+ * mapped and the old ones stay where they are, so indices and references are
+ * stable, nothing is copied and peak memory never doubles. Chunks come
+ * straight from anonymous mmap(), so they start zero-filled and untouched
+ * pages of a reserved chunk cost address space only.
+ */
+template <typename T>
+class Arena {
+  public:
+    static constexpr std::size_t chunk_bytes = std::size_t{2} << 20;
+    static constexpr std::size_t per_chunk = chunk_bytes / sizeof(T);
+
+    Arena() = default;
+
+    Arena(Arena &&other) noexcept {
+        *this = std::move(other);
+    }
+
+    auto operator=(Arena &&other) noexcept -> Arena & {
+        std::swap(chunks, other.chunks);
+        std::swap(count, other.count);
+        return *this;
+    }
+
+    /**
+     * Destructor for Arena.
+     *
+     * Unmaps every chunk.
+     */
+    ~Arena(void) {
+        for (T *chunk : chunks)
+            munmap(chunk, chunk_bytes);
+    }
+
+    auto operator[](const std::size_t i) -> T & {
+        return chunks[i / per_chunk][i % per_chunk];
+    }
+
+    auto operator[](const std::size_t i) const -> const T & {
+        return chunks[i / per_chunk][i % per_chunk];
+    }
+
+    auto size(void) const -> std::size_t {
+        return count;
+    }
+
+    /**
+     * The number of elements that still fit in the current chunk.
+     */
+    auto room(void) const -> std::size_t {
+        return count == chunks.size() * per_chunk ? 0 : per_chunk - count % per_chunk;
+    }
+
+    /**
+     * Bytes mapped so far.
+     */
+    auto bytes_reserved(void) const -> std::size_t {
+        return chunks.size() * chunk_bytes;
+    }
+
+    /**
+     * Appends `n` zero-filled elements that are contiguous in memory.
+     *
+     * If they do not fit in the current chunk, the rest of that chunk is
+     * skipped; callers that care can check room() first and recycle it.
+     *
+     * @param n The number of elements, at most `per_chunk`.
+     * @return The index of the first element.
+     */
+    auto allocate(const std::size_t n) -> std::size_t {
+        if (room() < n) {
+            count += room();
+            if (count == chunks.size() * per_chunk)
+                map_chunk();
+        }
+        count += n;
+        return count - n;
+    }
+
+    /**
+     * Appends one element.
+     *
+     * @return The index of the element.
+     */
+    auto push_back(const T &value) -> std::size_t {
+        const std::size_t i = allocate(1);
+        (*this)[i] = value;
+        return i;
+    }
+
+    /**
+     * Maps enough chunks up front to hold `n` elements.
+     */
+    auto reserve(const std::size_t n) -> void {
+        while (chunks.size() * per_chunk < n)
+            map_chunk();
+    }
+
+  private:
+    std::vector<T *> chunks;
+    std::size_t count = 0;
+
+    auto map_chunk(void) -> void {
+        const std::size_t length = arena_hugepages ? 2 * chunk_bytes : chunk_bytes;
+        void *addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (addr == MAP_FAILED)
+            throw std::bad_alloc();
+        char *chunk = static_cast<char *>(addr);
+        if (arena_hugepages) {
+            char *aligned = chunk + (-reinterpret_cast<std::uintptr_t>(chunk) & (chunk_bytes - 1));
+            if (aligned != chunk)
+                munmap(chunk, aligned - chunk);
+            munmap(aligned + chunk_bytes, chunk + length - (aligned + chunk_bytes));
+            chunk = aligned;
+#ifdef MADV_HUGEPAGE
+            madvise(chunk, chunk_bytes, MADV_HUGEPAGE);
+#endif
+        }
+        chunks.push_back(reinterpret_cast<T *>(chunk));
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/**
+ * The files of a corpus run, in the order their lines are numbered.
+ *
+ * Every line recorded in a corpus run packs the index of its file above the
+ * low `line_bits` bits of the line number, so the engines and WordInfo are
+ * the same as for a single file and recorded lines still sort in corpus
+ * order. printTable() unpacks them as `file:line`.
+ */
+struct Corpus {
+    static constexpr unsigned line_bits = 40;
+    static constexpr std::size_t max_files = std::size_t{1} << (64 - line_bits);
+
+    std::vector<std::string> names;
+    std::vector<std::size_t> sizes;
+
+    /**
+     * Lists the files of a corpus.
+     *
+     * Files are taken in the order given. A directory stands for every
+     * regular file below it, recursively, sorted by path. The size of a
+     * regular file is taken now; anything else, such as a pipe, gets a size
+     * of SIZE_MAX and is read to its end.
+     *
+     * @param paths The files and directories given on the command line.
+     * @return The corpus, or std::nullopt after printing an error.
+     */
+    static auto collect(const std::vector<const char *> &paths) -> std::optional<Corpus> {
+        namespace fs = std::filesystem;
+        Corpus corpus;
+        for (const char *path : paths) {
+            std::error_code error;
+            const fs::file_status status = fs::status(path, error);
+            if (error) {
+                std::cerr
+                    << std::format("can not open file {}", path)
+                    << std::endl;
+                return std::nullopt;
+            }
+            if (!fs::is_directory(status)) {
+                corpus.names.emplace_back(path);
+                corpus.sizes.push_back(fs::is_regular_file(status) ? fs::file_size(path, error) : SIZE_MAX);
+                continue;
+            }
+
+            std::vector<std::pair<std::string, std::size_t>> files;
+            for (fs::recursive_directory_iterator it(path, error), end; !error && it != end; it.increment(error))
+                if (it->is_regular_file(error))
+                    files.emplace_back(it->path().string(), it->file_size(error));
+            if (error) {
+                std::cerr
+                    << std::format("can not read directory {}", path)
+                    << std::endl;
+                return std::nullopt;
+            }
+            std::sort(files.begin(), files.end());
+            for (auto &[name, size] : files) {
+                corpus.names.push_back(std::move(name));
+                corpus.sizes.push_back(size);
+            }
+        }
+        if (corpus.names.size() > max_files) {
+            std::cerr
+                << std::format("can not count more than {} files", max_files)
+                << std::endl;
+            return std::nullopt;
+        }
+        return corpus;
+    }
+};
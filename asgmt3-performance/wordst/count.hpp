@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "simd.hpp"
+#include "word_info.hpp"
+
+/**
+ * Feeds every word produced by a reader into a counting engine.
+ *
+ * The loop is instantiated twice: with the default `--max-lines` as a
+ * constant and with the cap read at run time.
+ *
+ * @param reader A FileReader or MappedReader positioned at the start of input.
+ * @param engine The Trie or HashTable receiving the words and their line numbers.
+ */
+template <typename Reader, typename Engine>
+static inline auto count_words(Reader &reader, Engine &engine) -> void {
+    if (max_lines == limit)
+        reader.for_each_word([&](const std::string_view word, const std::size_t line) {
+            engine.template insert<limit>(word, line);
+        });
+    else
+        reader.for_each_word([&](const std::string_view word, const std::size_t line) {
+            engine.insert(word, line);
+        });
+}
+
+/**
+ * Engines that count_words_parallel() can count with: chunks counted apart
+ * must be shifted to their place in the input and merged.
+ */
+template <typename Engine>
+concept Mergeable = requires(Engine &engine, const Engine &other) {
+    engine.shift_lines(std::size_t{0});
+    engine.merge(other);
+};
+
+/**
+ * Counts the words of a mapped range on several threads.
+ *
+ * The range is cut into `jobs` chunks that each end just after a '\n' (or at
+ * the end of the range), so no word and no line straddles two chunks. Every
+ * thread tokenizes its chunk into its own engine, numbering lines from 1.
+ * Once all chunks are done, the newline counts of the chunks are prefix-summed
+ * into per-chunk offsets, each thread shifts its line numbers by its offset,
+ * and the engines are merged pairwise, always folding a later chunk into an
+ * earlier one. Counts are therefore exact and the recorded line numbers are
+ * the same ones, in the same order, as in a serial run.
+ *
+ * @param begin Start of the range; must not be in the middle of a word.
+ * @param end End of the range; the input ends there or at a non-letter.
+ * @param line The line number at `begin`, advanced past the range.
+ * @param jobs The number of threads, at least 1.
+ * @param reserve Whether each engine is sized up front for its chunk.
+ * @return The Trie or HashTable holding the words of the range.
+ */
+template <typename Engine>
+static inline auto count_words_parallel(const char *begin, const char *end, size_t &line, const size_t jobs, const bool reserve) -> Engine {
+    std::vector<const char *> bounds(jobs + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < jobs; ++i) {
+        const char *cut = std::max(bounds[i - 1], begin + (end - begin) / jobs * i);
+        const void *newline = cut == end ? nullptr : std::memchr(cut, '\n', end - cut);
+        bounds[i] = newline ? static_cast<const char *>(newline) + 1 : end;
+    }
+
+    std::vector<Engine> engines(jobs);
+    std::vector<size_t> newlines(jobs);
+    auto run = [&](auto &&task) {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < jobs; ++i)
+            threads.emplace_back(task, i);
+        task(0);
+        for (std::thread &thread : threads)
+            thread.join();
+    };
+
+    run([&](const size_t i) {
+        if (reserve)
+            engines[i].reserve(bounds[i + 1] - bounds[i]);
+        size_t line = 1;
+        if (max_lines == limit)
+            simd::scan_words(bounds[i], bounds[i + 1], true, line, [&](const std::string_view word, const size_t at) {
+                engines[i].template insert<limit>(word, at);
+            });
+        else
+            simd::scan_words(bounds[i], bounds[i + 1], true, line, [&](const std::string_view word, const size_t at) {
+                engines[i].insert(word, at);
+            });
+        newlines[i] = line - 1;
+    });
+
+    const size_t total = std::accumulate(newlines.begin(), newlines.end(), size_t{0});
+    std::exclusive_scan(newlines.begin(), newlines.end(), newlines.begin(), line - 1);
+    line += total;
+    run([&](const size_t i) {
+        engines[i].shift_lines(newlines[i]);
+    });
+
+    for (size_t stride = 1; stride < jobs; stride *= 2)
+        run([&](const size_t i) {
+            if (i % (2 * stride) == 0 && i + stride < jobs)
+                engines[i].merge(engines[i + stride]), engines[i + stride] = Engine();
+        });
+
+    return std::move(engines[0]);
+}
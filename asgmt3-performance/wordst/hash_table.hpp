@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "robin_hood.hpp"
+#include "word_info.hpp"
+
+/**
+ * Counting engine backed by an open-addressing hash table.
+ *
+ * With `Utf8` false, words are runs of ASCII letters and every byte is
+ * lowercased by setting bit 5. With `Utf8` true, words are arbitrary UTF-8
+ * and only 'A'-'Z' are lowercased, so bytes of multi-byte sequences, which
+ * scan_words() has already case folded, are kept as they are.
+ */
+template <bool Utf8>
+class BasicHashTable {
+  private:
+    /**
+     * Where a word's lowercase bytes live in the key arena.
+     */
+    struct key_t {
+        std::uint64_t offset;
+        std::uint32_t length;
+    };
+
+    static constexpr std::uint64_t fold = 0x2020202020202020;
+
+    RobinHoodIndex slots;
+    std::vector<char> arena;
+    Arena<key_t> keys;
+    Arena<WordInfo> infos;
+    std::size_t copied = 0;
+
+    /**
+     * Lowercases 'A'-'Z' in 8 bytes at once and leaves all other bytes,
+     * including those of 0x80 and above, unchanged.
+     */
+    static auto fold_upper(const std::uint64_t v) -> std::uint64_t {
+        const std::uint64_t low = v & 0x7F7F7F7F7F7F7F7F;
+        const std::uint64_t at_least_a = low + 0x3F3F3F3F3F3F3F3F;
+        const std::uint64_t past_z = low + 0x2525252525252525;
+        return v | ((at_least_a & ~past_z & ~v & 0x8080808080808080) >> 2);
+    }
+
+    /**
+     * Loads up to 8 bytes of a word into an integer, lowercased.
+     *
+     * Bytes past `length` read as zero and are not folded, so a word is never
+     * read past its end even when it lies at the very end of a mapping.
+     */
+    static auto load(const char *p, const std::size_t length) -> std::uint64_t {
+        std::uint64_t v = 0;
+        if (length >= 8) {
+            std::memcpy(&v, p, 8);
+            return Utf8 ? fold_upper(v) : v | fold;
+        }
+        std::memcpy(&v, p, length);
+        return Utf8 ? fold_upper(v) : v | (fold >> (64 - 8 * length));
+    }
+
+    /**
+     * Compares a word in any letter case with an interned lowercase key.
+     */
+    auto equals(const std::string_view word, const std::uint32_t id) const -> bool {
+        if (word.size() != keys[id].length)
+            return false;
+        const char *key = arena.data() + keys[id].offset;
+        for (std::size_t i = 0; i < word.size(); i += 8) {
+            const std::size_t length = std::min<std::size_t>(8, word.size() - i);
+            std::uint64_t k = 0;
+            std::memcpy(&k, key + i, length);
+            if (load(word.data() + i, length) != k)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Finds the id of a word, interning it first if it is new. See
+     * RobinHoodIndex::find_or_insert().
+     */
+    auto find_or_insert(const std::string_view word) -> std::uint32_t {
+        return slots.find_or_insert(hash(word), keys.size(), [&](const std::uint32_t id) { return equals(word, id); }, [&] {
+            if (arena.size() + word.size() > arena.capacity()) {
+                copied += arena.size();
+                arena.reserve(std::max(2 * arena.capacity(), arena.size() + word.size()));
+            }
+            const std::uint32_t id = keys.push_back(key_t{arena.size(), static_cast<std::uint32_t>(word.size())});
+            for (const char ch : word)
+                arena.push_back(Utf8 && static_cast<unsigned char>(ch - 'A') >= 26 ? ch : ch | 0x20);
+            infos.push_back(WordInfo{0, {}});
+            return id;
+        });
+    }
+
+  public:
+    /**
+     * Hashes the lowercase form of a word, 8 bytes per multiply, so a word
+     * hashes the same in any letter case. BasicHeavyHitters hashes with it
+     * too.
+     */
+    static auto hash(const std::string_view word) -> std::uint64_t {
+        std::uint64_t h = RobinHoodIndex::seed(word.size());
+        for (std::size_t i = 0; i < word.size(); i += 8)
+            h = RobinHoodIndex::mix(h, load(word.data() + i, word.size() - i));
+        return RobinHoodIndex::finish(h);
+    }
+
+    /**
+     * Interns a word without counting it. BasicNgramTable numbers its words
+     * with it.
+     *
+     * @param word The word, in any letter case.
+     * @return The dense id of the word, in the order words were first seen.
+     */
+    auto intern(const std::string_view word) -> std::uint32_t {
+        return find_or_insert(word);
+    }
+
+    /**
+     * The lowercase form of an interned word.
+     *
+     * @param id An id returned by intern().
+     */
+    auto key(const std::uint32_t id) const -> std::string_view {
+        return std::string_view(arena.data() + keys[id].offset, keys[id].length);
+    }
+
+    /**
+     * The number of distinct words.
+     */
+    auto size(void) const -> std::size_t {
+        return keys.size();
+    }
+
+    /**
+     * Constructor for the BasicHashTable class.
+     *
+     * Starts with the 1024 empty slots of a RobinHoodIndex, which doubles as
+     * words are added.
+     */
+    BasicHashTable() = default;
+
+    BasicHashTable(BasicHashTable &&) = default;
+    auto operator=(BasicHashTable &&) -> BasicHashTable & = default;
+
+    /**
+     * Destructor for BasicHashTable. See Trie::~Trie().
+     */
+    ~BasicHashTable(void) {
+        for (std::size_t i = 0; i < infos.size(); ++i)
+            infos[i].lines.release();
+    }
+
+    /**
+     * Sizes the tables up front for an input of the given size, assuming at
+     * most one distinct word per 64 bytes as Trie::reserve() does. Must be
+     * called before the first insert.
+     *
+     * @param bytes The size of the input.
+     */
+    auto reserve(const size_t bytes) -> void {
+        const size_t words = bytes / 64;
+        keys.reserve(words);
+        infos.reserve(words);
+        arena.reserve(words * 8);
+        slots.reserve(words);
+    }
+
+    /**
+     * Reports the bytes held by the slots, the key arena and the side tables,
+     * and the bytes copied when the slots or the key arena grew.
+     */
+    auto memory(void) const -> MemoryStats {
+        const MemoryStats index = slots.memory();
+        return MemoryStats{index.reserved + arena.capacity() + keys.bytes_reserved() + infos.bytes_reserved(), index.copied + copied};
+    }
+
+    /**
+     * Counts the words, their occurrences and the slots. See Trie::census().
+     */
+    auto census(void) const -> Census {
+        std::size_t tokens = 0, postings = 0;
+        for (std::size_t i = 0; i < infos.size(); ++i)
+            tokens += infos[i].count, postings += infos[i].lines.heap_bytes();
+        return Census{infos.size(), tokens, slots.capacity(), postings};
+    }
+
+    /**
+     * Inserts a word and records its occurrence line.
+     *
+     * Has the same contract as Trie::insert(): letters are folded to
+     * lowercase, the count is incremented and the line is recorded if fewer
+     * than `Cap` lines are recorded so far.
+     *
+     * @param word The ASCII letters to be inserted.
+     * @param line The line number where the word occurs.
+     * @tparam Cap The number of lines to record, see WordInfo::add().
+     */
+    template <std::size_t Cap = dynamic_lines>
+    auto insert(const std::string_view word, const size_t line) -> void {
+        infos[find_or_insert(word)].template add<Cap>(line);
+    }
+
+    /**
+     * Adds a constant to every recorded line number. See Trie::shift_lines().
+     *
+     * @param offset The number of lines before the chunk.
+     */
+    auto shift_lines(const size_t offset) -> void {
+        for (size_t j = 0; j < infos.size(); ++j)
+            infos[j].lines.shift(offset);
+    }
+
+    /**
+     * Merges the words of another table into this one. See Trie::merge().
+     *
+     * @param other The table to merge; it is left unchanged.
+     */
+    auto merge(const BasicHashTable &other) -> void {
+        for (std::uint32_t id = 0; id < other.keys.size(); ++id) {
+            const std::string_view word(other.arena.data() + other.keys[id].offset, other.keys[id].length);
+            const std::uint32_t mine = find_or_insert(word);
+            infos[mine].absorb(other.infos[id]);
+        }
+    }
+
+    /**
+     * Calls `visit(word, info)` for every word in lexicographic order, which
+     * is the order of Trie::for_each(), without copying any of them. Only
+     * the 4-byte ids are sorted.
+     *
+     * @param visit Takes a std::string_view and a const WordInfo &.
+     */
+    template <typename Visit>
+    auto for_each(Visit &&visit) const -> void {
+        std::vector<std::uint32_t> order(keys.size());
+        std::iota(order.begin(), order.end(), 0);
+        const auto word = [&](const std::uint32_t id) {
+            return std::string_view(arena.data() + keys[id].offset, keys[id].length);
+        };
+        std::sort(order.begin(), order.end(), [&](const std::uint32_t a, const std::uint32_t b) {
+            return word(a) < word(b);
+        });
+        for (const std::uint32_t id : order)
+            visit(word(id), infos[id]);
+    }
+
+    /**
+     * Retrieves all words along with their associated WordInfo.
+     *
+     * The words are returned in lexicographic order, which is the order
+     * Trie::get_all() produces, so both engines print the same table.
+     *
+     * @return A vector of pairs containing each word and its WordInfo.
+     */
+    auto get_all(void) const -> std::vector<std::pair<std::string, WordInfo>> {
+        std::vector<std::pair<std::string, WordInfo>> result;
+        result.reserve(keys.size());
+        for_each([&](const std::string_view word, const WordInfo &info) {
+            result.emplace_back(word, info);
+        });
+        return result;
+    }
+
+    /**
+     * Retrieves the `k` most frequent words, best first. See Trie::get_top().
+     *
+     * Unlike get_all(), the keys are never sorted; they are offered to the
+     * selection straight from the arena in insertion order.
+     *
+     * @param k The number of words to return.
+     * @return Up to `k` pairs of a word and its WordInfo.
+     */
+    auto get_top(const size_t k) const -> std::vector<std::pair<std::string, WordInfo>> {
+        TopK top(k, keys.size());
+        for (std::uint32_t id = 0; id < keys.size(); ++id)
+            top.offer(std::string_view(arena.data() + keys[id].offset, keys[id].length), infos[id]);
+        return top.take();
+    }
+};
+
+using HashTable = BasicHashTable<false>;
+using Utf8HashTable = BasicHashTable<true>;
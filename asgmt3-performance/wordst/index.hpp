@@ -0,0 +1,435 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "io.hpp"
+#include "trie.hpp"
+#include "word_info.hpp"
+
+/**
+ * A counted Trie saved to disk, queried in place through a read-only mapping.
+ *
+ * The file is the node array of the Trie, verbatim, a fixed-size record per
+ * WordInfo with its line list copied out as encoded, plus a ranking of all
+ * words and their spelled-out strings, so lookups walk the mapped nodes and
+ * top-K reads the first K ranking entries.
+ * Opening maps the file and checks the header and that every section lies
+ * inside the file; nothing is deserialized, so it takes the same time for any
+ * file size. The records are checked as they are read instead: a node, a
+ * ranking entry, a word or a line list that points outside its section makes
+ * the query return std::nullopt, so a damaged file is reported rather than
+ * read out of bounds. All integers are in native byte order, and a file
+ * written on a machine of the other byte order is rejected.
+ *
+ * An index doubles as a checkpoint: the header can record which file was
+ * counted, up to which byte and line, so a later run can load the Trie back
+ * with to_trie() and count only what was appended since.
+ *
+ * Layout, every section aligned to 8 bytes:
+ *
+ *     header_t
+ *     Trie::node_t   nodes[node_count]
+ *     info_t         infos[word_count]
+ *     std::uint32_t  ranking[word_count]   info indices, count desc, word asc
+ *     word_t         words[word_count]     spelling of each info index
+ *     char           strings[strings_size]
+ *     std::uint8_t   postings[postings_size]   Postings bytes of each info
+ */
+class Index {
+  public:
+    /**
+     * Where a checkpointed count stopped. `offset` is 0 for a plain index.
+     */
+    struct resume_t {
+        std::uint64_t device;
+        std::uint64_t inode;
+        std::uint64_t offset;
+        std::uint64_t line;
+        std::uint64_t fingerprint;
+    };
+
+    /**
+     * Hashes the last 4 KiB before `offset`, FNV-1a, to recognise the same
+     * file contents on the next run.
+     */
+    static auto fingerprint(const char *begin, const std::uint64_t offset) -> std::uint64_t {
+        std::uint64_t h = 0xCBF29CE484222325;
+        for (const char *p = begin + offset - std::min<std::uint64_t>(offset, 4096); p != begin + offset; ++p)
+            h = (h ^ static_cast<unsigned char>(*p)) * 0x100000001B3;
+        return h;
+    }
+
+  private:
+    static constexpr char magic[8] = {'W', 'O', 'R', 'D', 'S', 'T', 'I', 'X'};
+    static constexpr std::uint32_t version = 3;
+    static constexpr std::uint32_t byte_order = 0x01020304;
+
+    struct header_t {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t node_size;
+        std::uint32_t info_size;
+        std::uint64_t node_count;
+        std::uint64_t word_count;
+        std::uint64_t strings_size;
+        std::uint64_t nodes_offset;
+        std::uint64_t infos_offset;
+        std::uint64_t ranking_offset;
+        std::uint64_t words_offset;
+        std::uint64_t strings_offset;
+        std::uint64_t postings_offset;
+        std::uint64_t postings_size;
+        std::uint64_t max_lines;
+        std::uint64_t file_size;
+        resume_t resume;
+    };
+
+    struct info_t {
+        std::uint64_t count;
+        std::uint64_t last;
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    struct word_t {
+        std::uint64_t offset;
+        std::uint64_t length;
+    };
+
+    static auto align(const std::uint64_t offset) -> std::uint64_t {
+        return (offset + 7) & ~std::uint64_t{7};
+    }
+
+    const char *data = nullptr;
+    std::size_t size = 0;
+    const header_t *header = nullptr;
+    const Trie::node_t *nodes = nullptr;
+    const info_t *infos = nullptr;
+    const std::uint32_t *ranking = nullptr;
+    const word_t *words = nullptr;
+    const char *strings = nullptr;
+    const std::uint8_t *postings = nullptr;
+
+    /**
+     * The WordInfo of a record, reading its lines in place.
+     */
+    auto info(const std::uint32_t i) const -> WordInfo {
+        return WordInfo{infos[i].count, Postings::borrow(postings + infos[i].offset, infos[i].size, infos[i].last)};
+    }
+
+    /**
+     * Whether the line list of record `i` lies in the postings section and
+     * decodes within it: its last byte ends a number and no number is longer
+     * than the 10 bytes of a 64-bit one.
+     */
+    auto lines_valid(const std::uint64_t i) const -> bool {
+        const info_t &record = infos[i];
+        if (record.offset > header->postings_size || record.size > header->postings_size - record.offset)
+            return false;
+        unsigned run = 0;
+        for (std::uint64_t j = 0; j < record.size; ++j)
+            if ((run = postings[record.offset + j] & 0x80 ? run + 1 : 0) >= 10)
+                return false;
+        return run == 0;
+    }
+
+    /**
+     * Whether node `p` has letters only, its children in the node array and
+     * its record, if any, in the infos.
+     */
+    auto node_valid(const std::uint64_t p) const -> bool {
+        const Trie::node_t &node = nodes[p];
+        return node.info <= header->word_count && node.mask < (std::uint32_t{1} << 26) &&
+               (!node.mask || std::uint64_t{node.base} + std::popcount(node.mask) <= header->node_count);
+    }
+
+  public:
+    /**
+     * Writes a Trie to an index file.
+     *
+     * The spelled-out words are collected by one DFS, which also gives them
+     * in ascending order; a stable sort by count then yields the ranking.
+     * The file is written next to `path`, synced to disk and only then
+     * renamed over it, so neither a reader nor a crash leaves a partial
+     * index in its place.
+     *
+     * @param trie The Trie to save.
+     * @param path The file to create or replace.
+     * @param resume Where the count stopped, for a checkpoint.
+     * @return true if the whole file was written.
+     */
+    static auto save(const Trie &trie, const char *path, const resume_t resume = {}) -> bool {
+        const std::uint64_t word_count = trie.infos.size();
+        std::vector<word_t> spelled(word_count);
+        std::vector<std::uint32_t> order;
+        order.reserve(word_count);
+        std::string blob;
+
+        std::string current;
+        auto search = [&](std::uint32_t p, auto &&search) -> void {
+            if (trie.nodes[p].info) {
+                spelled[trie.nodes[p].info - 1] = word_t{blob.size(), current.size()};
+                blob += current;
+                order.push_back(trie.nodes[p].info - 1);
+            }
+            std::uint32_t q = trie.nodes[p].base;
+            for (std::uint32_t mask = trie.nodes[p].mask; mask; mask &= mask - 1) {
+                current.push_back(std::countr_zero(mask) + 'a');
+                search(q++, search);
+                current.pop_back();
+            }
+        };
+        search(Trie::root, search);
+        std::stable_sort(order.begin(), order.end(), [&](const std::uint32_t a, const std::uint32_t b) {
+            return trie.infos[a].count > trie.infos[b].count;
+        });
+
+        std::vector<info_t> records(word_count);
+        std::uint64_t postings_size = 0;
+        for (std::size_t i = 0; i < word_count; ++i) {
+            const Postings &lines = trie.infos[i].lines;
+            records[i] = info_t{trie.infos[i].count, lines.back(), postings_size, lines.bytes()};
+            postings_size += lines.bytes();
+        }
+
+        header_t head{};
+        std::memcpy(head.magic, magic, sizeof(magic));
+        head.version = version;
+        head.byte_order = byte_order;
+        head.node_size = sizeof(Trie::node_t);
+        head.info_size = sizeof(info_t);
+        head.node_count = trie.nodes.size();
+        head.word_count = word_count;
+        head.strings_size = blob.size();
+        head.nodes_offset = align(sizeof(header_t));
+        head.infos_offset = align(head.nodes_offset + head.node_count * sizeof(Trie::node_t));
+        head.ranking_offset = align(head.infos_offset + word_count * sizeof(info_t));
+        head.words_offset = align(head.ranking_offset + word_count * sizeof(std::uint32_t));
+        head.strings_offset = align(head.words_offset + word_count * sizeof(word_t));
+        head.postings_offset = align(head.strings_offset + blob.size());
+        head.postings_size = postings_size;
+        head.max_lines = ::max_lines;
+        head.file_size = head.postings_offset + postings_size;
+        head.resume = resume;
+
+        const std::string temporary = std::string(path) + ".tmp";
+        std::FILE *fp = fopen(temporary.c_str(), "wb");
+        if (!fp)
+            return false;
+        {
+            FileWriter writer(fp);
+            std::uint64_t written = 0;
+            const auto put = [&](const void *bytes, const std::size_t length) {
+                writer.put_string(std::string_view(static_cast<const char *>(bytes), length));
+                written += length;
+            };
+            const auto pad = [&](const std::uint64_t offset) {
+                writer.put_fill('\0', offset - written);
+                written = offset;
+            };
+
+            put(&head, sizeof(head));
+            pad(head.nodes_offset);
+            for (std::size_t i = 0; i < trie.nodes.size(); ++i)
+                put(&trie.nodes[i], sizeof(Trie::node_t));
+            pad(head.infos_offset);
+            put(records.data(), records.size() * sizeof(info_t));
+            pad(head.ranking_offset);
+            put(order.data(), order.size() * sizeof(std::uint32_t));
+            pad(head.words_offset);
+            put(spelled.data(), spelled.size() * sizeof(word_t));
+            pad(head.strings_offset);
+            put(blob.data(), blob.size());
+            pad(head.postings_offset);
+            for (std::size_t i = 0; i < word_count; ++i)
+                put(trie.infos[i].lines.data(), trie.infos[i].lines.bytes());
+        }
+        const bool ok = std::fflush(fp) == 0 && fsync(fileno(fp)) == 0 && !std::ferror(fp) && lseek(fileno(fp), 0, SEEK_END) == static_cast<off_t>(head.file_size);
+        if (fclose(fp) != 0 || !ok || std::rename(temporary.c_str(), path) != 0) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Maps an index file and checks its header and the bounds and alignment
+     * of its sections.
+     *
+     * @param path The index file.
+     * If the file cannot be mapped or is not a valid index of this version,
+     * valid() returns false.
+     */
+    explicit Index(const char *path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(header_t)) {
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                data = static_cast<const char *>(addr);
+                size = st.st_size;
+            }
+        }
+        close(fd);
+        if (!data)
+            return;
+
+        const header_t *head = reinterpret_cast<const header_t *>(data);
+        const auto fits = [&](const std::uint64_t offset, const std::uint64_t count, const std::uint64_t record) {
+            return offset % 8 == 0 && offset >= sizeof(header_t) && offset <= size && count <= (size - offset) / record;
+        };
+        if (std::memcmp(head->magic, magic, sizeof(magic)) || head->version != version || head->byte_order != byte_order ||
+            head->node_size != sizeof(Trie::node_t) || head->info_size != sizeof(info_t) || head->file_size != size ||
+            head->node_count == 0 || head->node_count > UINT32_MAX || head->word_count >= UINT32_MAX ||
+            !fits(head->nodes_offset, head->node_count, sizeof(Trie::node_t)) || !fits(head->infos_offset, head->word_count, sizeof(info_t)) ||
+            !fits(head->ranking_offset, head->word_count, sizeof(std::uint32_t)) || !fits(head->words_offset, head->word_count, sizeof(word_t)) ||
+            !fits(head->strings_offset, head->strings_size, 1) || !fits(head->postings_offset, head->postings_size, 1))
+            return;
+        header = head;
+        nodes = reinterpret_cast<const Trie::node_t *>(data + head->nodes_offset);
+        infos = reinterpret_cast<const info_t *>(data + head->infos_offset);
+        ranking = reinterpret_cast<const std::uint32_t *>(data + head->ranking_offset);
+        words = reinterpret_cast<const word_t *>(data + head->words_offset);
+        strings = data + head->strings_offset;
+        postings = reinterpret_cast<const std::uint8_t *>(data + head->postings_offset);
+    }
+
+    /**
+     * Destructor for Index.
+     *
+     * Unmaps the file.
+     */
+    ~Index(void) {
+        if (data)
+            munmap(const_cast<char *>(data), size);
+    }
+
+    Index(const Index &) = delete;
+    auto operator=(const Index &) -> Index & = delete;
+
+    /**
+     * Checks whether the file is a valid index.
+     */
+    auto valid(void) const -> bool {
+        return header != nullptr;
+    }
+
+    /**
+     * Where the counted file stopped, if this index is a checkpoint.
+     */
+    auto resume(void) const -> resume_t {
+        return header->resume;
+    }
+
+    /**
+     * The `--max-lines` the index was counted with.
+     */
+    auto max_lines(void) const -> std::size_t {
+        return header->max_lines;
+    }
+
+    /**
+     * Copies the nodes and WordInfo back into a Trie that can keep counting.
+     *
+     * The free lists of released child blocks are not saved, so those blocks
+     * stay unused in the loaded Trie. Every node reachable from the root is
+     * checked first and must be reached exactly once, and every line list
+     * must decode, so the Trie never walks out of its arrays.
+     *
+     * @return The Trie, or std::nullopt if the index is malformed.
+     */
+    auto to_trie(void) const -> std::optional<Trie> {
+        std::vector<bool> seen(header->node_count);
+        std::vector<std::uint32_t> pending{Trie::root};
+        seen[Trie::root] = true;
+        while (!pending.empty()) {
+            const std::uint32_t p = pending.back();
+            pending.pop_back();
+            if (!node_valid(p))
+                return std::nullopt;
+            for (std::uint32_t q = nodes[p].base, end = q + std::popcount(nodes[p].mask); q != end; ++q) {
+                if (seen[q])
+                    return std::nullopt;
+                seen[q] = true;
+                pending.push_back(q);
+            }
+        }
+        for (std::uint64_t i = 0; i < header->word_count; ++i)
+            if (!lines_valid(i))
+                return std::nullopt;
+
+        Trie trie;
+        trie.nodes[Trie::root] = nodes[Trie::root];
+        for (std::uint64_t i = 1; i < header->node_count; ++i)
+            trie.nodes.push_back(nodes[i]);
+        for (std::uint64_t i = 0; i < header->word_count; ++i) {
+            WordInfo &copy = trie.infos[trie.infos.push_back(WordInfo{infos[i].count, {}})];
+            copy.lines.append(info(i).lines, SIZE_MAX);
+        }
+        return trie;
+    }
+
+    /**
+     * Looks a word up by walking the mapped nodes.
+     *
+     * @param word The word, in any letter case.
+     * @return Its WordInfo, reading the mapped lines, with a count of 0 if the
+     *         index does not hold it, or std::nullopt if the index is
+     *         malformed along the way.
+     */
+    auto find(const std::string_view word) const -> std::optional<WordInfo> {
+        std::uint32_t p = Trie::root;
+        for (const char ch : word) {
+            const unsigned c = static_cast<unsigned char>((ch | 0x20) - 'a');
+            if (!node_valid(p))
+                return std::nullopt;
+            if (c >= 26 || !(nodes[p].mask >> c & 1))
+                return WordInfo{0, {}};
+            p = nodes[p].base + std::popcount(nodes[p].mask & ((std::uint32_t{1} << c) - 1));
+        }
+        if (!node_valid(p))
+            return std::nullopt;
+        if (!nodes[p].info)
+            return WordInfo{0, {}};
+        if (!lines_valid(nodes[p].info - 1))
+            return std::nullopt;
+        return info(nodes[p].info - 1);
+    }
+
+    /**
+     * Retrieves the `k` most frequent words, best first, from the ranking.
+     *
+     * @param k The number of words to return.
+     * @return Up to `k` pairs of a word and its WordInfo, or std::nullopt if
+     *         one of them is malformed.
+     */
+    auto get_top(const size_t k) const -> std::optional<std::vector<std::pair<std::string, WordInfo>>> {
+        std::vector<std::pair<std::string, WordInfo>> result;
+        result.reserve(std::min<std::uint64_t>(k, header->word_count));
+        for (std::uint64_t i = 0; i < std::min<std::uint64_t>(k, header->word_count); ++i) {
+            if (ranking[i] >= header->word_count || !lines_valid(ranking[i]))
+                return std::nullopt;
+            const word_t &word = words[ranking[i]];
+            if (word.offset > header->strings_size || word.length > header->strings_size - word.offset)
+                return std::nullopt;
+            result.emplace_back(std::string(strings + word.offset, word.length), info(ranking[i]));
+        }
+        return result;
+    }
+};
@@ -0,0 +1,991 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#endif
+#include <zlib.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "simd.hpp"
+
+static constexpr std::size_t buffer_size = 1 << 20;
+
+/**
+ * A bounded lock-free queue between exactly one producer and one consumer.
+ *
+ * The producer only writes `tail` and the consumer only writes `head`, each
+ * on its own cache line, so an element is handed over with one release store
+ * and one acquire load and no lock. A full or empty queue blocks with
+ * std::atomic::wait(), which spins briefly before sleeping in the kernel, so
+ * a stalled stage gives its core away instead of burning it.
+ *
+ * @tparam T A trivially copyable element, typically a pointer.
+ * @tparam N The capacity, a power of two.
+ */
+template <typename T, std::size_t N>
+class SpscQueue {
+    static_assert(std::has_single_bit(N));
+
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+    alignas(64) std::array<T, N> slots{};
+
+  public:
+    /**
+     * Appends an element, waiting while the queue is full. Producer only.
+     */
+    auto push(const T value) -> void {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        for (std::size_t h; t - (h = head.load(std::memory_order_acquire)) == N;)
+            head.wait(h, std::memory_order_acquire);
+        slots[t % N] = value;
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+    }
+
+    /**
+     * Removes the oldest element, waiting while the queue is empty. Consumer
+     * only.
+     */
+    auto pop(void) -> T {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        for (std::size_t t; (t = tail.load(std::memory_order_acquire)) == h;)
+            tail.wait(t, std::memory_order_acquire);
+        const T value = slots[h % N];
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return value;
+    }
+};
+
+/**
+ * Compressed formats recognized by their magic bytes.
+ */
+enum class compression_t { none, gzip, zstd };
+
+/**
+ * Recognizes a compressed format by the first bytes of a file.
+ *
+ * @param bytes The first bytes of the file.
+ * @param size How many bytes there are, up to 4 are looked at.
+ * @return The format, or compression_t::none for anything else.
+ */
+static inline auto detect_compression(const unsigned char *bytes, const std::size_t size) -> compression_t {
+    if (size >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B)
+        return compression_t::gzip;
+    if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xB5 && bytes[2] == 0x2F && bytes[3] == 0xFD)
+        return compression_t::zstd;
+    return compression_t::none;
+}
+
+/**
+ * Checks whether a regular file is compressed, with pread() so the file
+ * offset does not move. Compressed files can not be mapped and scanned in
+ * place.
+ *
+ * @param fd File descriptor of a regular file.
+ * @return true if the file starts with the magic bytes of gzip or zstd.
+ */
+static inline auto is_compressed(const int fd) -> bool {
+    unsigned char magic[4];
+    const ssize_t got = pread(fd, magic, sizeof(magic), 0);
+    return got > 0 && detect_compression(magic, got) != compression_t::none;
+}
+
+/**
+ * The bytes of a file, decompressed on a thread of its own if the file is
+ * compressed.
+ *
+ * The constructor reads the first bytes of the file to recognize gzip or
+ * zstd. Plain files are read with fread() on the calling thread, the sniffed
+ * bytes first. Compressed files are fed to zlib or libzstd by a decompressor
+ * thread, which fills a ring of `blocks` buffers handed over in SpscQueues,
+ * so the caller counts one buffer while the next is inflated and the wall
+ * time is that of the slower of the two. Concatenated gzip members and zstd
+ * frames are read as one stream, as gzip -d does. zstd input is only
+ * supported where <zstd.h> was found at build time and fails otherwise.
+ */
+class InputStream {
+  public:
+    static constexpr std::size_t blocks = 4;
+
+  private:
+    struct block_t {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+        bool last;
+    };
+
+    std::FILE *file;
+    unsigned char head[4];
+    std::size_t head_size, head_used = 0;
+    compression_t kind;
+    std::array<block_t, blocks> block_pool;
+    SpscQueue<block_t *, blocks> free_blocks, full_blocks;
+    block_t *current = nullptr;
+    std::size_t offset = 0;
+    bool failed = false;
+    std::thread worker;
+
+    /**
+     * Runs a streaming decoder over the rest of the file and hands the output
+     * over a block at a time. Trailing bytes after a complete stream that do
+     * not decode are ignored, as gzip -d does; a stream cut short or corrupt
+     * sets `failed`.
+     *
+     * @param step Callback decoding from `(in, in_left)` into `(out, out_left)`
+     *             and advancing both, returning 0 at the end of a member or
+     *             frame, 1 inside one and -1 on an error.
+     */
+    template <typename Step>
+    auto pump(Step &&step) -> void {
+        std::vector<unsigned char> input(buffer_size);
+        std::memcpy(input.data(), head, head_size);
+        const unsigned char *in = input.data();
+        std::size_t in_left = head_size;
+        bool finished = false;
+        for (bool last = false; !last;) {
+            block_t *block = free_blocks.pop();
+            char *out = block->data.get();
+            std::size_t out_left = buffer_size;
+            while (!last && out_left) {
+                if (!in_left) {
+                    in = input.data();
+                    in_left = fread(input.data(), 1, input.size(), file);
+                    if (!in_left) {
+                        failed = !finished || std::ferror(file);
+                        last = true;
+                        break;
+                    }
+                }
+                const int state = step(in, in_left, out, out_left);
+                if (state < 0) {
+                    failed = !finished;
+                    last = true;
+                }
+                finished = state == 0;
+            }
+            block->size = buffer_size - out_left;
+            block->last = last;
+            full_blocks.push(block);
+        }
+    }
+
+    /**
+     * The body of the decompressor thread.
+     */
+    auto decompress(void) -> void {
+        if (kind == compression_t::gzip) {
+            z_stream z{};
+            if (inflateInit2(&z, 15 + 16) == Z_OK) {
+                pump([&](const unsigned char *&in, std::size_t &in_left, char *&out, std::size_t &out_left) {
+                    z.next_in = const_cast<unsigned char *>(in);
+                    z.avail_in = in_left;
+                    z.next_out = reinterpret_cast<unsigned char *>(out);
+                    z.avail_out = out_left;
+                    const int rc = inflate(&z, Z_NO_FLUSH);
+                    in = z.next_in;
+                    in_left = z.avail_in;
+                    out = reinterpret_cast<char *>(z.next_out);
+                    out_left = z.avail_out;
+                    if (rc == Z_STREAM_END)
+                        return inflateReset(&z) == Z_OK ? 0 : -1;
+                    return rc == Z_OK ? 1 : -1;
+                });
+                inflateEnd(&z);
+                return;
+            }
+        }
+#if __has_include(<zstd.h>)
+        if (kind == compression_t::zstd) {
+            ZSTD_DStream *stream = ZSTD_createDStream();
+            if (stream && !ZSTD_isError(ZSTD_initDStream(stream))) {
+                pump([&](const unsigned char *&in, std::size_t &in_left, char *&out, std::size_t &out_left) {
+                    ZSTD_inBuffer source{in, in_left, 0};
+                    ZSTD_outBuffer target{out, out_left, 0};
+                    const std::size_t rc = ZSTD_decompressStream(stream, &target, &source);
+                    in += source.pos;
+                    in_left -= source.pos;
+                    out += target.pos;
+                    out_left -= target.pos;
+                    return ZSTD_isError(rc) ? -1 : rc == 0 ? 0 : 1;
+                });
+                ZSTD_freeDStream(stream);
+                return;
+            }
+            ZSTD_freeDStream(stream);
+        }
+#endif
+        block_t *block = free_blocks.pop();
+        block->size = 0;
+        block->last = true;
+        failed = true;
+        full_blocks.push(block);
+    }
+
+  public:
+    /**
+     * Constructor for InputStream.
+     *
+     * @param fp std::FILE to read from. The file pointer is not checked for
+     *           validity and is not closed.
+     *
+     * Reads up to 4 bytes to recognize the format and starts the
+     * decompressor thread if the file is compressed.
+     */
+    explicit InputStream(std::FILE *fp) {
+        file = fp;
+        head_size = fread(head, 1, sizeof(head), file);
+        kind = detect_compression(head, head_size);
+        if (kind == compression_t::none)
+            return;
+        for (block_t &block : block_pool) {
+            block = block_t{std::make_unique<char[]>(buffer_size), 0, false};
+            free_blocks.push(&block);
+        }
+        worker = std::thread(&InputStream::decompress, this);
+    }
+
+    /**
+     * Destructor for InputStream.
+     *
+     * Drains what the decompressor thread has left, so it can finish the
+     * file, and joins it.
+     */
+    ~InputStream(void) {
+        if (!worker.joinable())
+            return;
+        while (!current || !current->last) {
+            if (current)
+                free_blocks.push(current);
+            current = full_blocks.pop();
+        }
+        worker.join();
+    }
+
+    InputStream(const InputStream &) = delete;
+    auto operator=(const InputStream &) -> InputStream & = delete;
+
+    /**
+     * Reads up to `n` bytes of text, waiting for the decompressor thread if
+     * the file is compressed.
+     *
+     * @param dst Buffer of at least `n` bytes.
+     * @param n Number of bytes wanted.
+     * @return Number of bytes read, less than `n` only at the end of the file.
+     */
+    auto read(char *dst, const std::size_t n) -> std::size_t {
+        if (kind == compression_t::none) {
+            const std::size_t sniffed = std::min(n, head_size - head_used);
+            std::memcpy(dst, head + head_used, sniffed);
+            head_used += sniffed;
+            return sniffed + (sniffed < n ? fread(dst + sniffed, 1, n - sniffed, file) : 0);
+        }
+        std::size_t got = 0;
+        while (got < n) {
+            if (!current || offset == current->size) {
+                if (current && current->last)
+                    break;
+                if (current)
+                    free_blocks.push(current);
+                current = full_blocks.pop();
+                offset = 0;
+                continue;
+            }
+            const std::size_t length = std::min(n - got, current->size - offset);
+            std::memcpy(dst + got, current->data.get() + offset, length);
+            got += length;
+            offset += length;
+        }
+        return got;
+    }
+
+    /**
+     * The format recognized by the constructor.
+     */
+    auto compression(void) const -> compression_t {
+        return kind;
+    }
+
+    /**
+     * Checks whether the file was read without error. Meaningful once read()
+     * has returned less than it was asked for.
+     *
+     * @return false if compressed input was cut short or corrupt, or its
+     *         format is not supported by this build.
+     */
+    auto ok(void) const -> bool {
+        return !failed;
+    }
+};
+
+struct FileReader {
+    std::FILE *file;
+    char *buffer;
+    std::size_t capacity;
+    std::size_t line;
+    std::size_t bytes;
+    std::size_t refills;
+    bool failed;
+
+    /**
+     * Constructor for FileReader.
+     *
+     * @param fp std::FILE to read from.
+     *
+     * Initializes the FileReader object by setting the file pointer, allocating a
+     * buffer and setting the line number to 1. The file pointer is not checked for
+     * validity. `bytes` and `refills` count the bytes of text read and the
+     * refills made so far, and `failed` is set if the file is compressed and
+     * could not be decompressed.
+     */
+    FileReader(std::FILE *fp) {
+        file = fp;
+        capacity = buffer_size;
+        buffer = new char[capacity];
+        line = 1;
+        bytes = 0;
+        refills = 0;
+        failed = false;
+    }
+
+    /**
+     * Destructor for FileReader.
+     *
+     * Deallocates the buffer allocated in the constructor. The file pointer is not
+     * closed.
+     */
+    ~FileReader(void) {
+        delete[] buffer;
+    }
+
+    /**
+     * Calls `emit(word, line)` for every word in the file.
+     *
+     * The file is read a buffer at a time and each buffer is handed to
+     * simd::scan_words(). A word cut off by the end of the buffer is moved to
+     * the front before the next read, so every word is contiguous; the buffer
+     * doubles if a single word fills it. The views passed to `emit` are only
+     * valid during the call and keep the original letter case. Compressed
+     * files are decompressed through an InputStream.
+     *
+     * @param emit Callback receiving each word and its line number.
+     */
+    template <typename Emit>
+    auto for_each_word(Emit &&emit) -> void {
+        InputStream input(file);
+        std::size_t kept = 0;
+        for (bool eof = false; !eof;) {
+            if (kept == capacity) {
+                char *grown = new char[capacity * 2];
+                std::memcpy(grown, buffer, kept);
+                delete[] buffer;
+                buffer = grown;
+                capacity *= 2;
+            }
+            const std::size_t wanted = capacity - kept;
+            const std::size_t got = input.read(buffer + kept, wanted);
+            bytes += got;
+            ++refills;
+            eof = got < wanted;
+            const char *end = buffer + kept + got;
+            const char *rest = simd::scan_words(buffer, end, eof, line, emit);
+            kept = end - rest;
+            std::memmove(buffer, rest, kept);
+        }
+        failed = !input.ok();
+    }
+};
+
+/**
+ * Reads a file through a three-stage pipeline so that I/O overlaps with
+ * tokenizing and counting.
+ *
+ * A reader thread fills a ring of `blocks` buffers from an InputStream, which
+ * adds a decompressor thread ahead of it for compressed files, and cuts
+ * each one after its last non-letter, carrying the unfinished word over to
+ * the front of the next buffer, so every buffer holds whole words only. A
+ * tokenizer thread scans the buffers with simd::scan_words() into batches of
+ * (word, line) views, and the thread calling for_each_word() drains the
+ * batches into `emit`. A buffer goes back to the reader once its last batch
+ * is consumed. Every hand-over is an SpscQueue, and all queues can hold every
+ * buffer or batch at once, so only a slower downstream stage ever waits.
+ * Words that scan_words() hands over in a scratch buffer, as it does for
+ * case folded UTF-8, are copied into the batch.
+ */
+struct PipelinedReader {
+    static constexpr std::size_t blocks = 4;
+    static constexpr std::size_t batches = 8;
+    static constexpr std::size_t batch_size = 4096;
+
+    std::FILE *file;
+    std::size_t line;
+    std::size_t bytes;
+    std::size_t refills;
+    bool failed;
+
+    /**
+     * Constructor for PipelinedReader.
+     *
+     * @param fp std::FILE to read from. The file pointer is not checked for
+     *           validity and is not closed. `bytes` and `refills` count the
+     *           bytes of text read and the refills once for_each_word()
+     *           returns, and `failed` is set if the file is compressed and
+     *           could not be decompressed.
+     */
+    PipelinedReader(std::FILE *fp) {
+        file = fp;
+        line = 1;
+        bytes = 0;
+        refills = 0;
+        failed = false;
+    }
+
+    /**
+     * Calls `emit(word, line)` for every word in the file, on the calling
+     * thread.
+     *
+     * The views passed to `emit` are only valid during the call and keep
+     * the original letter case.
+     *
+     * @param emit Callback receiving each word and its line number.
+     */
+    template <typename Emit>
+    auto for_each_word(Emit &&emit) -> void {
+        struct block_t {
+            std::unique_ptr<char[]> data;
+            std::size_t capacity;
+            std::size_t size;
+            bool eof;
+        };
+        struct token_t {
+            const char *data;
+            std::size_t length;
+            std::size_t line;
+        };
+        struct batch_t {
+            std::vector<token_t> tokens;
+            std::string copied;
+            block_t *release;
+            bool last;
+        };
+
+        std::array<block_t, blocks> block_pool;
+        std::array<batch_t, batches> batch_pool;
+        SpscQueue<block_t *, blocks> free_blocks, full_blocks;
+        SpscQueue<batch_t *, batches> free_batches, full_batches;
+        for (block_t &block : block_pool) {
+            block = block_t{std::make_unique<char[]>(buffer_size), buffer_size, 0, false};
+            free_blocks.push(&block);
+        }
+        for (batch_t &batch : batch_pool) {
+            batch.tokens.reserve(batch_size);
+            free_batches.push(&batch);
+        }
+
+        std::thread reader([&] {
+            InputStream input(file);
+            std::vector<char> carry;
+            for (bool eof = false; !eof;) {
+                block_t *block = free_blocks.pop();
+                if (block->capacity < carry.size() * 2) {
+                    block->capacity = carry.size() * 2;
+                    block->data = std::make_unique<char[]>(block->capacity);
+                }
+                std::memcpy(block->data.get(), carry.data(), carry.size());
+                std::size_t size = carry.size();
+                for (;;) {
+                    const std::size_t wanted = block->capacity - size;
+                    const std::size_t got = input.read(block->data.get() + size, wanted);
+                    bytes += got;
+                    ++refills;
+                    size += got;
+                    eof = got < wanted;
+                    if (eof)
+                        break;
+                    std::size_t cut = size;
+                    while (cut && simd::is_letter(block->data[cut - 1]))
+                        --cut;
+                    if (cut) {
+                        carry.assign(block->data.get() + cut, block->data.get() + size);
+                        size = cut;
+                        break;
+                    }
+                    auto grown = std::make_unique<char[]>(block->capacity * 2);
+                    std::memcpy(grown.get(), block->data.get(), size);
+                    block->data = std::move(grown);
+                    block->capacity *= 2;
+                }
+                block->size = size;
+                block->eof = eof;
+                if (eof)
+                    failed = !input.ok();
+                full_blocks.push(block);
+            }
+        });
+
+        std::thread tokenizer([&] {
+            for (bool eof = false; !eof;) {
+                block_t *block = full_blocks.pop();
+                batch_t *batch = free_batches.pop();
+                const char *begin = block->data.get(), *end = begin + block->size;
+                simd::scan_words(begin, end, true, line, [&](const std::string_view word, const std::size_t at) {
+                    if (batch->tokens.size() == batch_size) {
+                        batch->release = nullptr;
+                        batch->last = false;
+                        full_batches.push(batch);
+                        batch = free_batches.pop();
+                    }
+                    if (word.data() >= begin && word.data() < end)
+                        batch->tokens.push_back(token_t{word.data(), word.size(), at});
+                    else {
+                        batch->copied += word;
+                        batch->tokens.push_back(token_t{nullptr, word.size(), at});
+                    }
+                });
+                eof = block->eof;
+                batch->release = block;
+                batch->last = eof;
+                full_batches.push(batch);
+            }
+        });
+
+        for (bool last = false; !last;) {
+            batch_t *batch = full_batches.pop();
+            std::size_t offset = 0;
+            for (const token_t &token : batch->tokens)
+                if (token.data)
+                    emit(std::string_view(token.data, token.length), token.line);
+                else {
+                    emit(std::string_view(batch->copied.data() + offset, token.length), token.line);
+                    offset += token.length;
+                }
+            batch->tokens.clear();
+            batch->copied.clear();
+            if (batch->release)
+                free_blocks.push(batch->release);
+            last = batch->last;
+            free_batches.push(batch);
+        }
+        reader.join();
+        tokenizer.join();
+    }
+};
+
+struct MappedReader {
+    const char *begin, *end;
+    std::size_t line;
+
+    /**
+     * Constructor for MappedReader.
+     *
+     * @param fd File descriptor of a regular file to map.
+     * @param size Size of the file in bytes, as reported by fstat().
+     *
+     * Maps the whole file read-only and advises the kernel that it will be read
+     * sequentially, so readahead is aggressive and pages behind the cursor can
+     * be dropped early. Transparent hugepages are requested as well where the
+     * kernel supports them for file mappings. If mapping fails, valid() returns
+     * false and the caller should fall back to FileReader. The descriptor may be
+     * closed once the object is constructed.
+     */
+    MappedReader(int fd, std::size_t size) {
+        begin = end = nullptr;
+        line = 1;
+        if (size == 0)
+            return;
+        void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+            return;
+        madvise(addr, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        madvise(addr, size, MADV_HUGEPAGE);
+#endif
+        begin = static_cast<const char *>(addr);
+        end = begin + size;
+    }
+
+    /**
+     * Destructor for MappedReader.
+     *
+     * Unmaps the file. Views passed to for_each_word() callbacks become invalid.
+     */
+    ~MappedReader(void) {
+        if (begin)
+            munmap(const_cast<char *>(begin), end - begin);
+    }
+
+    MappedReader(const MappedReader &) = delete;
+    auto operator=(const MappedReader &) -> MappedReader & = delete;
+
+    /**
+     * Checks whether the file was mapped successfully.
+     *
+     * @return true if the mapping exists.
+     */
+    auto valid(void) const -> bool {
+        return begin != nullptr;
+    }
+
+    /**
+     * Calls `emit(word, line)` for every word in the mapped file.
+     *
+     * The whole mapping is handed to simd::scan_words() at once, so the views
+     * point straight into the file and no byte of a word is copied. They stay
+     * valid for the lifetime of the reader.
+     *
+     * @param emit Callback receiving each word and its line number.
+     */
+    template <typename Emit>
+    auto for_each_word(Emit &&emit) -> void {
+        simd::scan_words(begin, end, true, line, emit);
+    }
+};
+
+/**
+ * Reads many small files with few system calls.
+ *
+ * Where the kernel offers io_uring, the reads of a batch are queued in the
+ * submission ring and submitted and awaited with a single io_uring_enter(),
+ * instead of one read() per file. Where it does not, for instance on old
+ * kernels or under a seccomp filter that blocks io_uring_setup(), every file
+ * is read with pread() on the calling thread, which still overlaps with the
+ * other threads of the pool. Short or failed ring reads are finished with
+ * pread() as well, so both paths fill the same bytes.
+ */
+class BatchReader {
+  public:
+    static constexpr unsigned depth = 64;
+
+    struct request_t {
+        int fd;
+        char *buffer;
+        std::size_t size;
+        std::size_t got;
+        int error;
+    };
+
+  private:
+    int ring = -1;
+#if __has_include(<linux/io_uring.h>)
+    void *sq_map = MAP_FAILED, *cq_map = MAP_FAILED, *sqe_map = MAP_FAILED;
+    std::size_t sq_bytes = 0, cq_bytes = 0, sqe_bytes = 0;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+
+    /**
+     * Unmaps the rings and closes the io_uring, falling back to pread().
+     */
+    auto release(void) -> void {
+        if (sqe_map != MAP_FAILED)
+            munmap(sqe_map, sqe_bytes);
+        if (cq_map != MAP_FAILED && cq_map != sq_map)
+            munmap(cq_map, cq_bytes);
+        if (sq_map != MAP_FAILED)
+            munmap(sq_map, sq_bytes);
+        sq_map = cq_map = sqe_map = MAP_FAILED;
+        if (ring >= 0)
+            close(ring);
+        ring = -1;
+    }
+
+    /**
+     * Submits the requests and waits for all of them; requests whose read
+     * failed keep got == 0. If the ring stops accepting work while none of
+     * it is in flight, it is released and pread() finishes the batch.
+     */
+    auto read_ring(request_t *requests, const unsigned n) -> void {
+        unsigned tail = *sq_tail;
+        for (unsigned i = 0; i < n; ++i) {
+            const unsigned index = tail++ & *sq_mask;
+            io_uring_sqe &sqe = sqes[index];
+            sqe = io_uring_sqe{};
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = requests[i].fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(requests[i].buffer);
+            sqe.len = static_cast<unsigned>(requests[i].size);
+            sqe.user_data = i;
+            sq_array[index] = index;
+        }
+        std::atomic_ref<unsigned>(*sq_tail).store(tail, std::memory_order_release);
+
+        for (unsigned unsubmitted = n, pending = n; pending;) {
+            const long entered = syscall(__NR_io_uring_enter, ring, unsubmitted, pending, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && unsubmitted == pending) {
+                release();
+                return;
+            }
+            if (entered > 0)
+                unsubmitted -= std::min<unsigned>(entered, unsubmitted);
+
+            unsigned head = *cq_head;
+            for (; head != std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire); ++head, --pending) {
+                const io_uring_cqe &cqe = cqes[head & *cq_mask];
+                requests[cqe.user_data].got = cqe.res > 0 ? cqe.res : 0;
+            }
+            std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+        }
+    }
+#endif
+
+  public:
+    /**
+     * Sets up an io_uring of `depth` entries if the kernel allows it.
+     */
+    BatchReader(void) {
+#if __has_include(<linux/io_uring.h>)
+        io_uring_params params{};
+        const int fd = syscall(__NR_io_uring_setup, depth, &params);
+        if (fd < 0)
+            return;
+        sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+        sqe_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        sq_map = mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_map = single ? sq_map : mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqe_map = mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        ring = fd;
+        if (sq_map == MAP_FAILED || cq_map == MAP_FAILED || sqe_map == MAP_FAILED) {
+            release();
+            return;
+        }
+
+        char *sq = static_cast<char *>(sq_map), *cq = static_cast<char *>(cq_map);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe *>(sqe_map);
+#endif
+    }
+
+    /**
+     * Unmaps the rings and closes the io_uring, if any.
+     */
+    ~BatchReader(void) {
+#if __has_include(<linux/io_uring.h>)
+        release();
+#endif
+    }
+
+    BatchReader(const BatchReader &) = delete;
+    auto operator=(const BatchReader &) -> BatchReader & = delete;
+
+    /**
+     * Checks whether reads go through io_uring.
+     */
+    auto uring(void) const -> bool {
+        return ring >= 0;
+    }
+
+    /**
+     * Reads every request from offset 0 into its buffer.
+     *
+     * On return, `got` is the number of bytes read, short only at the end of
+     * the file or on an error, and `error` is the errno of a failed read or 0.
+     *
+     * @param requests The reads; at most `depth` of them.
+     * @param n The number of requests.
+     */
+    auto read(request_t *requests, const std::size_t n) -> void {
+        assert(n <= depth);
+        for (std::size_t i = 0; i < n; ++i)
+            requests[i].got = 0, requests[i].error = 0;
+#if __has_include(<linux/io_uring.h>)
+        if (ring >= 0 && n)
+            read_ring(requests, n);
+#endif
+        for (std::size_t i = 0; i < n; ++i) {
+            request_t &request = requests[i];
+            while (request.got < request.size) {
+                const ssize_t got = pread(request.fd, request.buffer + request.got, request.size - request.got, request.got);
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got < 0)
+                    request.error = errno;
+                if (got <= 0)
+                    break;
+                request.got += got;
+            }
+        }
+    }
+};
+
+struct FileWriter {
+    int fd;
+    char *buffer;
+    char *ptr, *end;
+
+    /**
+     * Constructs a FileWriter object that writes to the specified file.
+     *
+     * @param fp std::FILE to write to.
+     *
+     * Initializes the FileWriter object by taking the file descriptor behind
+     * the file pointer, allocating a buffer and setting the buffer pointers to
+     * the beginning of the buffer. Output bypasses stdio, so nothing else
+     * should write to the same file while the FileWriter exists. The file
+     * pointer is not checked for validity.
+     */
+    FileWriter(std::FILE *fp) {
+        std::fflush(fp);
+        fd = fileno(fp);
+        buffer = new char[buffer_size];
+        ptr = buffer;
+        end = buffer + buffer_size;
+    }
+
+    /**
+     * Destructor for FileWriter.
+     *
+     * Ensures any buffered data is written to the file by calling flush() and
+     * deallocates the buffer memory. This is called automatically when the
+     * FileWriter object goes out of scope.
+     */
+    ~FileWriter(void) {
+        flush();
+        delete[] buffer;
+    }
+
+    /**
+     * Flushes the buffer by writing any buffered data to the file.
+     *
+     * Ensures any data stored in the buffer is written to the file and resets
+     * the buffer pointer to the beginning of the buffer.
+     */
+    auto flush(void) -> void {
+        write_all(buffer, ptr - buffer, nullptr, 0);
+        ptr = buffer;
+    }
+
+    /**
+     * Puts a single character into the output stream.
+     *
+     * The character is placed in the buffer. If the buffer is full, it is flushed
+     * automatically.
+     */
+    auto put_char(char ch) -> void {
+        if (ptr == end)
+            flush();
+        *ptr++ = ch;
+    }
+
+    /**
+     * Writes a string to the output stream.
+     *
+     * The string is copied into the buffer if it fits. Otherwise the buffered
+     * data and the string go out together in a single writev(), so a large
+     * string is never copied.
+     */
+    auto put_string(const std::string_view str) -> void {
+        if (static_cast<std::size_t>(end - ptr) >= str.size()) {
+            std::memcpy(ptr, str.data(), str.size());
+            ptr += str.size();
+            return;
+        }
+        write_all(buffer, ptr - buffer, str.data(), str.size());
+        ptr = buffer;
+    }
+
+    /**
+     * Writes `n` copies of a character, with memset().
+     */
+    auto put_fill(const char ch, std::size_t n) -> void {
+        while (n) {
+            if (ptr == end)
+                flush();
+            const std::size_t length = std::min<std::size_t>(n, end - ptr);
+            std::memset(ptr, ch, length);
+            ptr += length;
+            n -= length;
+        }
+    }
+
+    /**
+     * Writes an unsigned integer in decimal, straight into the buffer.
+     *
+     * Digits are produced two at a time from a 200-byte table, from the
+     * least significant end, into space reserved for the final length.
+     *
+     * @return The number of digits written.
+     */
+    auto put_uint(std::uint64_t value) -> std::size_t {
+        static constexpr auto pairs = [] {
+            std::array<char, 200> table{};
+            for (std::size_t i = 0; i < 100; ++i)
+                table[2 * i] = '0' + i / 10, table[2 * i + 1] = '0' + i % 10;
+            return table;
+        }();
+
+        std::size_t digits = 1;
+        for (std::uint64_t rest = value; rest >= 10; rest /= 10)
+            ++digits;
+        if (static_cast<std::size_t>(end - ptr) < digits)
+            flush();
+
+        char *p = ptr + digits;
+        for (; value >= 100; value /= 100)
+            p -= 2, std::memcpy(p, pairs.data() + 2 * (value % 100), 2);
+        if (value >= 10)
+            p -= 2, std::memcpy(p, pairs.data() + 2 * value, 2);
+        else
+            *--p = '0' + value;
+        ptr += digits;
+        return digits;
+    }
+
+  private:
+    /**
+     * Writes two byte ranges in order with writev(), retrying on short
+     * writes and EINTR.
+     */
+    auto write_all(const char *first, std::size_t first_size, const char *second, std::size_t second_size) -> void {
+        while (first_size + second_size) {
+            iovec parts[2] = {{const_cast<char *>(first), first_size}, {const_cast<char *>(second), second_size}};
+            const ssize_t written = writev(fd, first_size ? parts : parts + 1, first_size ? 2 : 1);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            std::size_t done = written;
+            const std::size_t from_first = std::min(done, first_size);
+            first += from_first, first_size -= from_first, done -= from_first;
+            second += done, second_size -= done;
+        }
+    }
+};
@@ -0,0 +1,470 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <unistd.h>
+
+#include "simd.hpp"
+
+/**
+ * JSON output that never allocates, shared by wordst_good and
+ * asgmt1-style/serialize_json.cpp.
+ *
+ * Everything writes into a Sink: any type with `put_char(char)`,
+ * `put_string(std::string_view)` and `put_uint(std::uint64_t)`, such as
+ * FileWriter, StringSink or a ChunkSink.
+ */
+
+/**
+ * A Sink that appends to a std::string.
+ */
+struct StringSink {
+    std::string &out;
+
+    auto put_char(const char ch) -> void {
+        out += ch;
+    }
+
+    auto put_string(const std::string_view str) -> void {
+        out += str;
+    }
+
+    auto put_uint(const std::uint64_t value) -> std::size_t {
+        char digits[20];
+        char *end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        out.append(digits, end);
+        return end - digits;
+    }
+};
+
+/**
+ * A Sink that collects output in a fixed buffer of `N` bytes and hands it
+ * to `consume(std::string_view)` a chunk at a time, so a document of any
+ * size is written in constant memory. A string that does not fit in the
+ * buffer is handed over after the buffered bytes without being copied.
+ * fd_sink() builds one that writes to a file descriptor.
+ *
+ * @tparam Consume Callback receiving every chunk, valid during the call.
+ * @tparam N The size of the buffer, at least 20 bytes for put_uint().
+ */
+template <typename Consume, std::size_t N = std::size_t{1} << 16>
+class ChunkSink {
+    static_assert(N >= 20);
+
+    Consume consume;
+    std::array<char, N> buffer;
+    std::size_t used = 0;
+
+  public:
+    explicit ChunkSink(Consume consume) : consume(std::move(consume)) {}
+
+    /**
+     * Destructor for ChunkSink. Hands over what is still buffered.
+     */
+    ~ChunkSink(void) {
+        flush();
+    }
+
+    ChunkSink(const ChunkSink &) = delete;
+    auto operator=(const ChunkSink &) -> ChunkSink & = delete;
+
+    /**
+     * Hands the buffered bytes to `consume`, if there are any.
+     */
+    auto flush(void) -> void {
+        if (used)
+            consume(std::string_view(buffer.data(), used));
+        used = 0;
+    }
+
+    auto put_char(const char ch) -> void {
+        if (used == N)
+            flush();
+        buffer[used++] = ch;
+    }
+
+    auto put_string(const std::string_view str) -> void {
+        if (N - used < str.size()) {
+            flush();
+            if (str.size() >= N) {
+                consume(str);
+                return;
+            }
+        }
+        std::memcpy(buffer.data() + used, str.data(), str.size());
+        used += str.size();
+    }
+
+    auto put_uint(const std::uint64_t value) -> std::size_t {
+        if (N - used < 20)
+            flush();
+        char *end = std::to_chars(buffer.data() + used, buffer.data() + N, value).ptr;
+        const std::size_t digits = end - (buffer.data() + used);
+        used += digits;
+        return digits;
+    }
+};
+
+/**
+ * A ChunkSink that writes every chunk to a file descriptor, retrying on
+ * short writes and EINTR. Write errors are dropped, as FileWriter drops
+ * them.
+ *
+ * @param fd The file descriptor; it is not closed.
+ */
+static inline auto fd_sink(const int fd) {
+    return ChunkSink([fd](std::string_view chunk) {
+        while (!chunk.empty()) {
+            const ssize_t written = write(fd, chunk.data(), chunk.size());
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            chunk.remove_prefix(written);
+        }
+    });
+}
+
+namespace json {
+
+/**
+ * Ranges that JsonWriter::write() turns into objects: ranges of pairs or
+ * tuples whose first element is a key.
+ */
+template <typename T>
+concept pair_range = std::ranges::input_range<T> && requires(std::ranges::range_reference_t<T> member) {
+    requires std::tuple_size<std::remove_cvref_t<decltype(member)>>::value == 2;
+    { std::get<0>(member) } -> std::convertible_to<std::string_view>;
+};
+
+/**
+ * The escape sequence of a byte, `length` 0 if it goes out as it is.
+ */
+struct escape_t {
+    char text[6];
+    unsigned char length;
+};
+
+/**
+ * The escape sequence of every byte: `"` and `\` and the control
+ * characters with a short form get it, the other control characters and DEL
+ * get `\u00XX`. Bytes 0x80 and above are left alone, so UTF-8 text stays
+ * UTF-8.
+ */
+inline constexpr auto escapes = [] {
+    std::array<escape_t, 256> table{};
+    constexpr char hex[] = "0123456789abcdef";
+    for (std::size_t c = 0; c < 256; ++c)
+        if (c < 0x20 || c == 0x7F)
+            table[c] = escape_t{{'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]}, 6};
+    for (const auto &[c, short_form] : {std::pair{'"', '"'}, {'\\', '\\'}, {'\b', 'b'}, {'\f', 'f'}, {'\n', 'n'}, {'\r', 'r'}, {'\t', 't'}})
+        table[static_cast<unsigned char>(c)] = escape_t{{'\\', short_form}, 2};
+    return table;
+}();
+
+/**
+ * Portable kernel: the escape mask of 16 bytes from the escape table, one
+ * byte per iteration without branches.
+ */
+struct ScalarEscapes {
+    static constexpr std::size_t width = 16;
+
+    static auto mask(const char *block) -> std::uint32_t {
+        std::uint32_t bits = 0;
+        for (std::size_t i = 0; i < width; ++i)
+            bits |= static_cast<std::uint32_t>(escapes[static_cast<unsigned char>(block[i])].length != 0) << i;
+        return bits;
+    }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * SSE2 kernel, 16 bytes per block.
+ *
+ * SSE2 has no unsigned byte compare, but a byte is at most 0x1F exactly
+ * when its unsigned minimum with 0x1F is itself; `"`, `\` and DEL are
+ * compared directly.
+ */
+struct Sse2Escapes {
+    static constexpr std::size_t width = 16;
+
+    __attribute__((target("sse2"))) static auto mask(const char *block) -> std::uint32_t {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+        const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+        const __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+        const __m128i backslash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+        const __m128i del = _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F));
+        return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(control, quote), _mm_or_si128(backslash, del)));
+    }
+};
+
+/**
+ * AVX2 kernel, 32 bytes per block. Same arithmetic as Sse2Escapes.
+ */
+struct Avx2Escapes {
+    static constexpr std::size_t width = 32;
+
+    __attribute__((target("avx2"))) static auto mask(const char *block) -> std::uint32_t {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        const __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v);
+        const __m256i quote = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+        const __m256i backslash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+        const __m256i del = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7F));
+        return _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(control, quote), _mm256_or_si256(backslash, del)));
+    }
+};
+
+#endif
+
+/**
+ * Escapes a string a block at a time with one kernel.
+ *
+ * Every set bit of a block's mask ends the clean run before it, which goes
+ * to the sink in one put_string(), followed by the escape from the table; a
+ * block without bits costs one mask and no copy. The last partial block is
+ * the full block that ends with the string, with the bits it shares with
+ * the previous block dropped, so only strings shorter than a block are
+ * looked up a byte at a time.
+ */
+template <typename Kernel, typename Sink>
+static inline auto escape_blocks(Sink &sink, const std::string_view str) -> void {
+    const char *begin = str.data(), *end = begin + str.size(), *clean = begin;
+    const auto emit = [&](const char *block, std::uint32_t bits) {
+        for (; bits; bits &= bits - 1) {
+            const char *at = block + std::countr_zero(bits);
+            const escape_t &escape = escapes[static_cast<unsigned char>(*at)];
+            sink.put_string(std::string_view(clean, at - clean));
+            sink.put_string(std::string_view(escape.text, escape.length));
+            clean = at + 1;
+        }
+    };
+
+    const char *p = begin;
+    for (; static_cast<std::size_t>(end - p) >= Kernel::width; p += Kernel::width)
+        emit(p, Kernel::mask(p));
+    if (p != end && str.size() >= Kernel::width) {
+        const char *block = end - Kernel::width;
+        emit(block, Kernel::mask(block) & ~((std::uint32_t{1} << (p - block)) - 1));
+    } else
+        for (; p != end; ++p)
+            if (escapes[static_cast<unsigned char>(*p)].length)
+                emit(p, 1);
+    sink.put_string(std::string_view(clean, end - clean));
+}
+
+/**
+ * A Sink over a caller buffer that is known to be large enough.
+ */
+struct PointerSink {
+    char *ptr;
+
+    auto put_string(const std::string_view str) -> void {
+        std::memcpy(ptr, str.data(), str.size());
+        ptr += str.size();
+    }
+};
+
+} // namespace json
+
+/**
+ * Writes the JSON escaped form of a string, without the quotes.
+ *
+ * The bytes are classified 16 or 32 at a time by the kernel chosen by
+ * simd::kernel, so `--simd` narrows it as it does the tokenizer, see
+ * json::escape_blocks(). Plain text is one vector compare per block and one
+ * copy.
+ *
+ * @param sink The Sink to write to.
+ * @param str The raw bytes.
+ */
+template <typename Sink>
+static inline auto escape_json(Sink &sink, const std::string_view str) -> void {
+#if defined(__x86_64__) || defined(__i386__)
+    if (simd::kernel == simd::kernel_t::avx2)
+        return json::escape_blocks<json::Avx2Escapes>(sink, str);
+    if (simd::kernel == simd::kernel_t::sse2)
+        return json::escape_blocks<json::Sse2Escapes>(sink, str);
+#endif
+    json::escape_blocks<json::ScalarEscapes>(sink, str);
+}
+
+/**
+ * The most bytes escape_json() can write for a string of `size` bytes.
+ */
+static constexpr auto max_escaped_size(const std::size_t size) -> std::size_t {
+    return 6 * size;
+}
+
+/**
+ * Writes the JSON escaped form of a string into a caller buffer, without
+ * the quotes.
+ *
+ * @param out A buffer of at least max_escaped_size(str.size()) bytes.
+ * @param str The raw bytes.
+ * @return The end of the escaped bytes.
+ */
+static inline auto escape_json(char *out, const std::string_view str) -> char * {
+    json::PointerSink sink{out};
+    escape_json(sink, str);
+    return sink.ptr;
+}
+
+/**
+ * Writes a JSON document as a stream of events into a Sink.
+ *
+ * Objects and arrays nest up to `max_depth` levels; whether a container has
+ * had an element yet is one bit per level, so the writer holds no buffer and
+ * never allocates, and commas and colons are placed for the caller. Events
+ * must form a valid document: key() and a value alternate inside objects,
+ * values follow each other inside arrays.
+ *
+ * @tparam Sink See above.
+ */
+template <typename Sink>
+class JsonWriter {
+  public:
+    static constexpr unsigned max_depth = 63;
+
+  private:
+    Sink &sink;
+    std::uint64_t empty = 1;
+    unsigned depth = 0;
+    bool after_key = false;
+    bool lines;
+
+    /**
+     * Puts the comma before an element, or nothing after a key or before the
+     * first element of a container.
+     */
+    auto separate(void) -> void {
+        if (after_key) {
+            after_key = false;
+            return;
+        }
+        if (!(empty >> depth & 1))
+            sink.put_char(',');
+        if (lines && depth == 1)
+            sink.put_char('\n');
+        empty &= ~(std::uint64_t{1} << depth);
+    }
+
+    auto open(const char bracket) -> void {
+        separate();
+        sink.put_char(bracket);
+        assert(depth < max_depth);
+        empty |= std::uint64_t{2} << depth++;
+    }
+
+    auto close(const char bracket) -> void {
+        if (lines && depth == 1 && !(empty >> depth & 1))
+            sink.put_char('\n');
+        --depth;
+        sink.put_char(bracket);
+    }
+
+  public:
+    /**
+     * @param sink The Sink to write to; must outlive the writer.
+     * @param lines Whether to start every element of the outermost container
+     *              on a line of its own, so the document can be read a line
+     *              at a time.
+     */
+    explicit JsonWriter(Sink &sink, const bool lines = false) : sink(sink), lines(lines) {}
+
+    auto begin_object(void) -> void {
+        open('{');
+    }
+
+    auto end_object(void) -> void {
+        close('}');
+    }
+
+    auto begin_array(void) -> void {
+        open('[');
+    }
+
+    auto end_array(void) -> void {
+        close(']');
+    }
+
+    /**
+     * Writes the key of the next member of an object.
+     */
+    auto key(const std::string_view name) -> void {
+        separate();
+        sink.put_char('"');
+        escape_json(sink, name);
+        sink.put_string("\":");
+        after_key = true;
+    }
+
+    /**
+     * Writes a string value.
+     */
+    auto value(const std::string_view str) -> void {
+        separate();
+        sink.put_char('"');
+        escape_json(sink, str);
+        sink.put_char('"');
+    }
+
+    /**
+     * Writes an unsigned integer value.
+     */
+    auto value(const std::uint64_t number) -> void {
+        separate();
+        sink.put_uint(number);
+    }
+
+    /**
+     * Writes a value of any shape, walking nested ranges as they are
+     * iterated, so nothing is collected on the way.
+     *
+     * Strings and whatever converts to std::string_view become JSON strings
+     * and unsigned integers become numbers. A range of pairs, such as a
+     * std::map, an std::unordered_map, a vector of pairs or a view that
+     * generates them, becomes an object of its keys and their values; any
+     * other range becomes an array. Values are written with write() in turn,
+     * so they may be ranges themselves.
+     *
+     * @param item The value.
+     */
+    template <typename T>
+    auto write(T &&item) -> void {
+        using type = std::remove_cvref_t<T>;
+        if constexpr (std::is_convertible_v<T, std::string_view>)
+            value(std::string_view(item));
+        else if constexpr (std::is_unsigned_v<type> && !std::is_same_v<type, bool>)
+            value(static_cast<std::uint64_t>(item));
+        else if constexpr (json::pair_range<type>) {
+            begin_object();
+            for (auto &&member : item) {
+                key(std::get<0>(member));
+                write(std::get<1>(member));
+            }
+            end_object();
+        } else {
+            static_assert(std::ranges::input_range<type>, "JsonWriter::write() takes strings, unsigned integers and ranges of them");
+            begin_array();
+            for (auto &&element : item)
+                write(element);
+            end_array();
+        }
+    }
+};
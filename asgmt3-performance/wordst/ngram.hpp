@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "hash_table.hpp"
+#include "robin_hood.hpp"
+#include "word_info.hpp"
+
+/**
+ * The number of consecutive words counted together by BasicNgramTable, set
+ * by `--ngram N`.
+ */
+inline std::size_t ngram_length = 2;
+
+/**
+ * Counting engine for n-grams, runs of `ngram_length` consecutive words.
+ *
+ * Every word is interned once in a BasicHashTable and stands for its dense
+ * 32-bit id from then on, so an n-gram is a packed key of N ids rather than
+ * a string. The keys live in an Arena at a stride of N rounded up to a power
+ * of two, so no key straddles two chunks and a key is found from its id with
+ * a shift, and a RobinHoodIndex, as in BasicHashTable, finds the id of a
+ * key. An n-gram costs its key, its WordInfo and about one and a quarter
+ * slots; no string is built until the table is printed.
+ *
+ * The line of an n-gram is the line of its first word, and n-grams run on
+ * across line breaks, as sentences do. `Utf8` picks the case folding of the
+ * words, see BasicHashTable.
+ */
+template <bool Utf8>
+class BasicNgramTable {
+  public:
+    static constexpr std::size_t max_length = 8;
+
+  private:
+    BasicHashTable<Utf8> words;
+    std::size_t n = ngram_length;
+    unsigned shift = std::bit_width(std::bit_ceil(n)) - 1;
+    std::array<std::uint32_t, max_length> recent{};
+    std::array<std::size_t, max_length> starts{};
+    std::size_t seen = 0;
+    RobinHoodIndex slots;
+    Arena<std::uint32_t> keys;
+    Arena<WordInfo> infos;
+
+    /**
+     * Hashes the word ids of an n-gram, two ids per multiply.
+     */
+    static auto hash(const std::uint32_t *ids, const std::size_t n) -> std::uint64_t {
+        std::uint64_t h = RobinHoodIndex::seed(n);
+        for (std::size_t i = 0; i < n; i += 2)
+            h = RobinHoodIndex::mix(h, ids[i] | (i + 1 < n ? std::uint64_t{ids[i + 1]} << 32 : 0));
+        return RobinHoodIndex::finish(h);
+    }
+
+    /**
+     * The word ids of an n-gram, contiguous.
+     */
+    auto key(const std::uint32_t id) const -> const std::uint32_t * {
+        return &keys[std::size_t{id} << shift];
+    }
+
+    /**
+     * Finds the id of an n-gram, adding it first if it is new.
+     *
+     * @param gram The ids of its `n` words.
+     */
+    auto find_or_insert(const std::uint32_t *gram) -> std::uint32_t {
+        return slots.find_or_insert(hash(gram, n), infos.size(), [&](const std::uint32_t id) { return std::equal(gram, gram + n, key(id)); }, [&] {
+            const std::uint32_t id = infos.push_back(WordInfo{0, {}});
+            std::copy(gram, gram + n, &keys[keys.allocate(std::size_t{1} << shift)]);
+            return id;
+        });
+    }
+
+    /**
+     * Writes the words of an n-gram into `out`, separated by single spaces.
+     */
+    auto join(const std::uint32_t id, std::string &out) const -> void {
+        out.clear();
+        for (std::size_t i = 0; i < n; ++i) {
+            if (i)
+                out += ' ';
+            out += words.key(key(id)[i]);
+        }
+    }
+
+  public:
+    /**
+     * Constructor for the BasicNgramTable class.
+     *
+     * Takes the n-gram length from `ngram_length`, from 2 to `max_length`,
+     * and starts with the 1024 empty slots of a RobinHoodIndex.
+     */
+    BasicNgramTable() {
+        assert(n >= 2 && n <= max_length);
+    }
+
+    BasicNgramTable(BasicNgramTable &&) = default;
+    auto operator=(BasicNgramTable &&) -> BasicNgramTable & = default;
+
+    /**
+     * Destructor for BasicNgramTable. See Trie::~Trie().
+     */
+    ~BasicNgramTable(void) {
+        for (std::size_t i = 0; i < infos.size(); ++i)
+            infos[i].lines.release();
+    }
+
+    /**
+     * Sizes the tables up front for an input of the given size, assuming at
+     * most one distinct n-gram per 16 bytes. Must be called before the first
+     * insert.
+     *
+     * @param bytes The size of the input.
+     */
+    auto reserve(const size_t bytes) -> void {
+        const size_t grams = bytes / 16;
+        words.reserve(bytes);
+        keys.reserve(grams << shift);
+        infos.reserve(grams);
+        slots.reserve(grams);
+    }
+
+    /**
+     * Reports the bytes held by the word table, the slots, the keys and the
+     * WordInfo side table, and the bytes copied while growing them.
+     */
+    auto memory(void) const -> MemoryStats {
+        const MemoryStats interned = words.memory(), index = slots.memory();
+        return MemoryStats{interned.reserved + index.reserved + keys.bytes_reserved() + infos.bytes_reserved(), interned.copied + index.copied};
+    }
+
+    /**
+     * Counts the distinct n-grams, their occurrences and the slots. See
+     * Trie::census().
+     */
+    auto census(void) const -> Census {
+        std::size_t tokens = 0, postings = 0;
+        for (std::size_t i = 0; i < infos.size(); ++i)
+            tokens += infos[i].count, postings += infos[i].lines.heap_bytes();
+        return Census{infos.size(), tokens, slots.capacity(), postings};
+    }
+
+    /**
+     * Inserts the next word of the input and counts the n-gram it ends.
+     *
+     * The last `n` word ids and their lines are kept in a small window; the
+     * first `n - 1` words end no n-gram.
+     *
+     * @param word The letters of the word, in any case.
+     * @param line The line number where the word occurs.
+     * @tparam Cap The number of lines to record, see WordInfo::add().
+     */
+    template <std::size_t Cap = dynamic_lines>
+    auto insert(const std::string_view word, const size_t line) -> void {
+        std::copy(recent.begin() + 1, recent.begin() + n, recent.begin());
+        std::copy(starts.begin() + 1, starts.begin() + n, starts.begin());
+        recent[n - 1] = words.intern(word);
+        starts[n - 1] = line;
+        if (++seen >= n)
+            infos[find_or_insert(recent.data())].template add<Cap>(starts[0]);
+    }
+
+    /**
+     * Retrieves all n-grams, each as its words joined by single spaces,
+     * along with their WordInfo.
+     *
+     * The n-grams are returned in lexicographic order of the joined strings,
+     * as the word engines return theirs. The vocabulary is sorted once and
+     * the keys are sorted by the ranks of their words, which gives the same
+     * order because a space sorts below every byte of a word.
+     *
+     * @return A vector of pairs containing each n-gram and its WordInfo.
+     */
+    auto get_all(void) const -> std::vector<std::pair<std::string, WordInfo>> {
+        std::vector<std::uint32_t> rank(words.size());
+        {
+            std::vector<std::uint32_t> vocabulary(words.size());
+            std::iota(vocabulary.begin(), vocabulary.end(), 0);
+            std::sort(vocabulary.begin(), vocabulary.end(), [&](const std::uint32_t a, const std::uint32_t b) {
+                return words.key(a) < words.key(b);
+            });
+            for (std::uint32_t i = 0; i < vocabulary.size(); ++i)
+                rank[vocabulary[i]] = i;
+        }
+
+        std::vector<std::uint32_t> order(infos.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](const std::uint32_t a, const std::uint32_t b) {
+            const std::uint32_t *x = key(a), *y = key(b);
+            for (std::size_t i = 0; i < n; ++i)
+                if (x[i] != y[i])
+                    return rank[x[i]] < rank[y[i]];
+            return false;
+        });
+
+        std::vector<std::pair<std::string, WordInfo>> result;
+        result.reserve(order.size());
+        std::string gram;
+        for (const std::uint32_t id : order) {
+            join(id, gram);
+            result.emplace_back(gram, infos[id]);
+        }
+        return result;
+    }
+
+    /**
+     * Retrieves the `k` most frequent n-grams, best first. See
+     * Trie::get_top().
+     *
+     * @param k The number of n-grams to return.
+     * @return Up to `k` pairs of an n-gram and its WordInfo.
+     */
+    auto get_top(const size_t k) const -> std::vector<std::pair<std::string, WordInfo>> {
+        TopK top(k, infos.size());
+        std::string gram;
+        for (std::uint32_t id = 0; id < infos.size(); ++id) {
+            join(id, gram);
+            top.offer(gram, infos[id]);
+        }
+        return top.take();
+    }
+};
+
+using NgramTable = BasicNgramTable<false>;
+using Utf8NgramTable = BasicNgramTable<true>;
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "corpus.hpp"
+#include "io.hpp"
+#include "json.hpp"
+#include "simd.hpp"
+#include "unicode.hpp"
+#include "word_info.hpp"
+
+static inline auto printTable(const std::vector<std::pair<std::string, WordInfo>> &wordsVector, const std::vector<size_t> &order, std::FILE *fp = stdout, const Corpus *corpus = nullptr) -> void;
+
+/**
+ * Output formats of the report.
+ */
+enum class format_t { table, json, csv };
+
+/**
+ * The format printTable() and ReportWriter write in, set by `--format`.
+ */
+inline format_t report_format = format_t::table;
+
+/**
+ * Ranks words by occurrence count descending and then by word ascending.
+ *
+ * The words must be in ascending order, as get_all() returns them, so a
+ * stable sort by count alone gives the full order and the ranking is the
+ * same for every engine and thread count. Each word becomes one size_t
+ * element holding its index in the low bits and `max - count` above, and
+ * the elements are LSD radix sorted one byte of the key per pass; passes
+ * over bytes the keys do not use are skipped. With `jobs` above 1, large
+ * inputs are cut into one block per thread and every pass histograms and
+ * scatters the blocks in parallel, each thread writing behind the elements
+ * of the lower digits and of the earlier blocks of its own digit, which
+ * keeps the sort stable.
+ *
+ * @param wordsVector A vector of pairs, where each pair consists of a word
+ *                    (std::string) and its corresponding WordInfo.
+ * @param jobs The number of threads, at least 1.
+ * @return The indices into wordsVector, in rank order.
+ */
+static inline auto rankStatis(const std::vector<std::pair<std::string, WordInfo>> &wordsVector, const size_t jobs = 1) -> std::vector<size_t> {
+    static constexpr size_t radix = 256, per_thread = size_t{1} << 18;
+    const size_t n = wordsVector.size();
+    std::vector<size_t> elements(n);
+    size_t max = 0;
+    for (size_t i = 0; i < n; ++i)
+        max = std::max(max, elements[i] = wordsVector[i].second.count);
+
+    const unsigned index_bits = std::bit_width(n - (n != 0)), key_bits = std::bit_width(max);
+    if (index_bits + key_bits > 8 * sizeof(size_t)) {
+        std::iota(elements.begin(), elements.end(), 0);
+        std::stable_sort(elements.begin(), elements.end(), [&](const size_t a, const size_t b) {
+            return wordsVector[a].second.count > wordsVector[b].second.count;
+        });
+        return elements;
+    }
+    for (size_t i = 0; i < n; ++i)
+        elements[i] = (max - elements[i]) << index_bits | i;
+
+    std::vector<size_t> scratch(n);
+    const size_t threads = std::clamp<size_t>(n / per_thread, 1, jobs);
+    std::vector<std::array<size_t, radix>> counts(threads);
+    auto run = [&](auto &&task) {
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; ++t)
+            workers.emplace_back(task, t, n * t / threads, n * (t + 1) / threads);
+        task(0, 0, n / threads);
+        for (std::thread &worker : workers)
+            worker.join();
+    };
+
+    for (unsigned shift = index_bits; shift < index_bits + key_bits; shift += 8) {
+        run([&](const size_t t, const size_t begin, const size_t end) {
+            counts[t].fill(0);
+            for (size_t i = begin; i < end; ++i)
+                ++counts[t][elements[i] >> shift & (radix - 1)];
+        });
+
+        const size_t first = elements[0] >> shift & (radix - 1);
+        size_t same = 0;
+        for (size_t t = 0; t < threads; ++t)
+            same += counts[t][first];
+        if (same == n)
+            continue;
+
+        size_t offset = 0;
+        for (size_t digit = 0; digit < radix; ++digit)
+            for (size_t t = 0; t < threads; ++t)
+                offset += std::exchange(counts[t][digit], offset);
+
+        run([&](const size_t t, const size_t begin, const size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                scratch[counts[t][elements[i] >> shift & (radix - 1)]++] = elements[i];
+        });
+        elements.swap(scratch);
+    }
+
+    const size_t mask = (size_t{1} << index_bits) - 1;
+    for (size_t &element : elements)
+        element &= mask;
+    return elements;
+}
+
+/**
+ * Prints the statistics of words stored in a vector of pairs.
+ *
+ * This function takes a vector containing pairs of words and their associated
+ * WordInfo, and prints the word statistics in a formatted table. The statistics
+ * include the word, its occurrence count, and the line numbers where it appears.
+ * The words are sorted by their occurrence count in descending order, ties
+ * in word order, by rankStatis().
+ *
+ * @param wordsVector A vector of pairs, where each pair consists of a word
+ *                    (std::string) and its corresponding WordInfo.
+ * @param corpus The files of a corpus run, to print lines as `file:line`.
+ * @param jobs The number of threads to rank the words on.
+ */
+static inline auto printStatis(const std::vector<std::pair<std::string, WordInfo>> &wordsVector, const Corpus *corpus = nullptr, const size_t jobs = 1) -> void {
+    assert(!wordsVector.empty());
+
+    printTable(wordsVector, rankStatis(wordsVector, jobs), stdout, corpus);
+}
+
+/**
+ * Prints one row of the table into a FileWriter: the word padded to 20
+ * columns, the count padded to 5 and the comma-separated lines. In UTF-8
+ * mode, the word is padded by its display width rather than its byte length.
+ *
+ * @param writer The writer to print to.
+ * @param word The word.
+ * @param info Its count and lines.
+ * @param corpus The files of a corpus run, to print lines as `file:line`.
+ */
+static inline auto printRow(FileWriter &writer, const std::string_view word, const WordInfo &info, const Corpus *corpus = nullptr) -> void {
+    writer.put_string(word);
+    writer.put_fill(' ', 21 - std::min<size_t>(simd::utf8 ? unicode::width(word) : word.size(), 20));
+    writer.put_fill(' ', 6 - std::min<size_t>(writer.put_uint(info.count), 5));
+    bool first = true;
+    info.lines.for_each([&](const std::size_t line) {
+        if (!first)
+            writer.put_char(',');
+        first = false;
+        if (corpus) {
+            writer.put_string(corpus->names[line >> Corpus::line_bits]);
+            writer.put_char(':');
+            writer.put_uint(line & ((std::size_t{1} << Corpus::line_bits) - 1));
+        } else
+            writer.put_uint(line);
+    });
+    writer.put_char('\n');
+}
+
+/**
+ * Writes the ranked rows of a report in `report_format`, straight into a
+ * FileWriter buffer.
+ *
+ * The table has the header and rows of printRow(). JSON is one array with
+ * an object per word on a line of its own, `{"word":...,"count":...,
+ * "lines":[...]}`, where a corpus line is `{"file":...,"line":...}`. CSV has
+ * one record per line of a word, under a `word,count,line` header, or
+ * `word,count,file,line` for a corpus, so every field holds a single value;
+ * a word without recorded lines has one record with them empty. The header
+ * goes out on construction and the end of the document on destruction, so
+ * rows can be streamed from a merge as well as printed from a vector.
+ */
+class ReportWriter {
+    FileWriter writer;
+    JsonWriter<FileWriter> json;
+    const Corpus *corpus;
+
+    /**
+     * Writes a CSV field, quoted with every `"` doubled if it holds a comma,
+     * a quote or a line break.
+     */
+    auto put_csv(std::string_view text) -> void {
+        if (text.find_first_of(",\"\r\n") == std::string_view::npos)
+            return writer.put_string(text);
+        writer.put_char('"');
+        for (std::size_t at; (at = text.find('"')) != std::string_view::npos;) {
+            writer.put_string(text.substr(0, at + 1));
+            writer.put_char('"');
+            text.remove_prefix(at + 1);
+        }
+        writer.put_string(text);
+        writer.put_char('"');
+    }
+
+  public:
+    /**
+     * @param fp The stream to print to.
+     * @param corpus The files of a corpus run, to print lines with their file.
+     */
+    explicit ReportWriter(std::FILE *fp, const Corpus *corpus = nullptr) : writer(fp), json(writer, true), corpus(corpus) {
+        if (report_format == format_t::json)
+            json.begin_array();
+        else if (report_format == format_t::csv)
+            writer.put_string(corpus ? "word,count,file,line\n" : "word,count,line\n");
+        else
+            writer.put_string("WORD                 COUNT APPEARS-LINES\n");
+    }
+
+    /**
+     * Ends the document and flushes it.
+     */
+    ~ReportWriter(void) {
+        if (report_format == format_t::json) {
+            json.end_array();
+            writer.put_char('\n');
+        }
+    }
+
+    ReportWriter(const ReportWriter &) = delete;
+    auto operator=(const ReportWriter &) -> ReportWriter & = delete;
+
+    /**
+     * Writes the row of one word.
+     */
+    auto row(const std::string_view word, const WordInfo &info) -> void {
+        const std::size_t line_mask = (std::size_t{1} << Corpus::line_bits) - 1;
+        if (report_format == format_t::json) {
+            json.begin_object();
+            json.key("word");
+            json.value(word);
+            json.key("count");
+            json.value(info.count);
+            json.key("lines");
+            json.begin_array();
+            info.lines.for_each([&](const std::size_t line) {
+                if (!corpus)
+                    return json.value(line);
+                json.begin_object();
+                json.key("file");
+                json.value(corpus->names[line >> Corpus::line_bits]);
+                json.key("line");
+                json.value(line & line_mask);
+                json.end_object();
+            });
+            json.end_array();
+            json.end_object();
+        } else if (report_format == format_t::csv) {
+            const auto start = [&] {
+                put_csv(word);
+                writer.put_char(',');
+                writer.put_uint(info.count);
+                writer.put_char(',');
+            };
+            bool any = false;
+            info.lines.for_each([&](const std::size_t line) {
+                start();
+                if (corpus) {
+                    put_csv(corpus->names[line >> Corpus::line_bits]);
+                    writer.put_char(',');
+                    writer.put_uint(line & line_mask);
+                } else
+                    writer.put_uint(line);
+                writer.put_char('\n');
+                any = true;
+            });
+            if (!any) {
+                start();
+                writer.put_string(corpus ? ",\n" : "\n");
+            }
+        } else
+            printRow(writer, word, info, corpus);
+    }
+};
+
+/**
+ * Prints the statistics of already ranked words.
+ *
+ * Used by `--top K`, whose selection is already in rank order, and by
+ * printStatis() once it has ranked the words. Rows are formatted straight
+ * into the FileWriter buffer by a ReportWriter, in the table layout of the
+ * format string "{:<20} {:<5} " followed by the comma-separated lines, or as
+ * JSON or CSV, without building any temporary string.
+ *
+ * @param wordsVector A vector of pairs, where each pair consists of a word
+ *                    (std::string) and its corresponding WordInfo.
+ * @param order The indices into wordsVector, in the order to print them.
+ * @param fp The stream to print to, stdout by default.
+ * @param corpus The files of a corpus run, to print lines as `file:line`.
+ */
+static inline auto printTable(const std::vector<std::pair<std::string, WordInfo>> &wordsVector, const std::vector<size_t> &order, std::FILE *fp, const Corpus *corpus) -> void {
+    ReportWriter report(fp, corpus);
+    for (const auto i : order)
+        report.row(wordsVector[i].first, wordsVector[i].second);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+
+/**
+ * The open-addressing table behind BasicHashTable and BasicNgramTable: it
+ * maps a key to the dense id its owner numbered it with, and leaves the keys
+ * themselves to the owner.
+ *
+ * A slot is 8 bytes: `id` is the id plus one, 0 for an empty slot, and
+ * `hash` keeps the low 32 bits of the key's hash, which pick the home slot
+ * and filter almost all key comparisons. Slots are placed Robin Hood style
+ * and the table is kept at most 80% full, doubling as keys are added.
+ */
+class RobinHoodIndex {
+  private:
+    struct slot_t {
+        std::uint32_t hash;
+        std::uint32_t id;
+    };
+
+    std::vector<slot_t> slots;
+    std::uint32_t mask;
+    std::size_t copied = 0;
+
+    /**
+     * Places a slot known not to be in the table, Robin Hood style.
+     *
+     * Walks from the home slot and swaps the carried slot with any resident
+     * that sits closer to its own home, so probe lengths stay short and even.
+     */
+    auto place(slot_t slot) -> void {
+        std::uint32_t pos = slot.hash & mask;
+        for (std::uint32_t dist = 0;; pos = (pos + 1) & mask, ++dist) {
+            if (!slots[pos].id) {
+                slots[pos] = slot;
+                return;
+            }
+            const std::uint32_t resident = (pos - slots[pos].hash) & mask;
+            if (resident < dist) {
+                std::swap(slot, slots[pos]);
+                dist = resident;
+            }
+        }
+    }
+
+    /**
+     * Doubles the table and re-places every slot from its stored hash.
+     */
+    auto grow(void) -> void {
+        std::vector<slot_t> old(slots.size() * 2, slot_t{0, 0});
+        old.swap(slots);
+        mask = slots.size() - 1;
+        copied += old.size() * sizeof(slot_t);
+        for (const slot_t slot : old)
+            if (slot.id)
+                place(slot);
+    }
+
+  public:
+    /**
+     * The steps of the hash of a key of `length` words: seed(length), then
+     * mix() with every 64-bit word of the key, then finish(), as in
+     * splitmix64.
+     */
+    static auto seed(const std::size_t length) -> std::uint64_t {
+        return length * 0x9E3779B97F4A7C15;
+    }
+
+    static auto mix(std::uint64_t h, const std::uint64_t word) -> std::uint64_t {
+        h = (h ^ word) * 0xBF58476D1CE4E5B9;
+        return h ^ (h >> 31);
+    }
+
+    static auto finish(std::uint64_t h) -> std::uint64_t {
+        h *= 0x94D049BB133111EB;
+        return h ^ (h >> 29);
+    }
+
+    /**
+     * Constructor for the RobinHoodIndex class. Starts with 1024 empty slots.
+     */
+    RobinHoodIndex() {
+        slots.assign(1024, slot_t{0, 0});
+        mask = slots.size() - 1;
+    }
+
+    /**
+     * Finds the id of a key, having the owner add it first if it is new.
+     *
+     * Lookups stop as soon as they reach a slot closer to its home than the
+     * key would be, which is where a Robin Hood insert would have put it.
+     *
+     * @param hash The hash of the key.
+     * @param size The number of keys in the table.
+     * @param equals `equals(id)` is whether the key is the one of `id`.
+     * @param add `add()` stores the key and returns its id, `size`.
+     * @return The id of the key.
+     */
+    template <typename Equals, typename Add>
+    auto find_or_insert(const std::uint32_t hash, const std::size_t size, Equals &&equals, Add &&add) -> std::uint32_t {
+        if ((size + 1) * 5 > slots.size() * 4)
+            grow();
+
+        std::uint32_t pos = hash & mask;
+        for (std::uint32_t dist = 0;; pos = (pos + 1) & mask, ++dist) {
+            const slot_t slot = slots[pos];
+            if (!slot.id || ((pos - slot.hash) & mask) < dist)
+                break;
+            if (slot.hash == hash && equals(slot.id - 1))
+                return slot.id - 1;
+        }
+
+        const std::uint32_t id = add();
+        place(slot_t{hash, id + 1});
+        return id;
+    }
+
+    /**
+     * Sizes the table for the given number of keys. Must be called while the
+     * table is empty.
+     */
+    auto reserve(const std::size_t keys) -> void {
+        while (slots.size() * 4 < keys * 5)
+            slots.resize(slots.size() * 2);
+        mask = slots.size() - 1;
+    }
+
+    /**
+     * The number of slots.
+     */
+    auto capacity(void) const -> std::size_t {
+        return slots.size();
+    }
+
+    /**
+     * Reports the bytes held by the slots and the bytes copied when they grew.
+     */
+    auto memory(void) const -> MemoryStats {
+        return MemoryStats{slots.capacity() * sizeof(slot_t), copied};
+    }
+};
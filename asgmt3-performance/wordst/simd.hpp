@@ -0,0 +1,277 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "unicode.hpp"
+
+namespace simd {
+
+/**
+ * Letter, newline and non-ASCII bitmasks of one 64-byte block.
+ *
+ * Bit i of `letters` is set if byte i is an ASCII letter, bit i of `newlines`
+ * is set if byte i is '\n' and bit i of `high` is set if byte i is 0x80 or
+ * above, that is, part of a multi-byte UTF-8 sequence.
+ */
+struct masks_t {
+    std::uint64_t letters;
+    std::uint64_t newlines;
+    std::uint64_t high;
+};
+
+/**
+ * Portable kernel, one byte per iteration without branches.
+ *
+ * A byte is a letter iff `(c | 0x20) - 'a' < 26`: setting bit 5 maps 'A'-'Z'
+ * onto 'a'-'z' (lowercasing in-register) and maps no other byte into that
+ * range. This is exactly std::isalpha() in the "C" locale, without the table
+ * lookup.
+ */
+struct ScalarKernel {
+    static auto classify(const char *block) -> masks_t {
+        masks_t masks{0, 0, 0};
+        for (std::size_t i = 0; i < 64; ++i) {
+            const unsigned char c = block[i];
+            masks.letters |= static_cast<std::uint64_t>(static_cast<unsigned char>((c | 0x20) - 'a') < 26) << i;
+            masks.newlines |= static_cast<std::uint64_t>(c == '\n') << i;
+            masks.high |= static_cast<std::uint64_t>(c >> 7) << i;
+        }
+        return masks;
+    }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * SSE2 kernel, four 16-byte lanes per block.
+ *
+ * SSE2 has no unsigned byte compare, so the lowercased byte is biased by
+ * 0x80 - 'a', which moves 'a'-'z' onto the 26 smallest signed values.
+ */
+struct Sse2Kernel {
+    __attribute__((target("sse2"))) static auto classify(const char *block) -> masks_t {
+        const __m128i fold = _mm_set1_epi8(0x20);
+        const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80 - 'a'));
+        const __m128i bound = _mm_set1_epi8(static_cast<char>(0x80 + 26));
+        const __m128i newline = _mm_set1_epi8('\n');
+        masks_t masks{0, 0, 0};
+        for (std::size_t i = 0; i < 4; ++i) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * i));
+            const __m128i lower = _mm_add_epi8(_mm_or_si128(v, fold), bias);
+            const std::uint64_t letters = static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_cmplt_epi8(lower, bound)));
+            const std::uint64_t newlines = static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+            const std::uint64_t high = static_cast<std::uint16_t>(_mm_movemask_epi8(v));
+            masks.letters |= letters << (16 * i);
+            masks.newlines |= newlines << (16 * i);
+            masks.high |= high << (16 * i);
+        }
+        return masks;
+    }
+};
+
+/**
+ * AVX2 kernel, two 32-byte lanes per block. Same arithmetic as Sse2Kernel.
+ */
+struct Avx2Kernel {
+    __attribute__((target("avx2"))) static auto classify(const char *block) -> masks_t {
+        const __m256i fold = _mm256_set1_epi8(0x20);
+        const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80 - 'a'));
+        const __m256i bound = _mm256_set1_epi8(static_cast<char>(0x80 + 26));
+        const __m256i newline = _mm256_set1_epi8('\n');
+        masks_t masks{0, 0, 0};
+        for (std::size_t i = 0; i < 2; ++i) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32 * i));
+            const __m256i lower = _mm256_add_epi8(_mm256_or_si256(v, fold), bias);
+            const std::uint64_t letters = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(bound, lower)));
+            const std::uint64_t newlines = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)));
+            const std::uint64_t high = static_cast<std::uint32_t>(_mm256_movemask_epi8(v));
+            masks.letters |= letters << (32 * i);
+            masks.newlines |= newlines << (32 * i);
+            masks.high |= high << (32 * i);
+        }
+        return masks;
+    }
+};
+
+#endif
+
+/**
+ * Whether scan_words() segments UTF-8 text, see `--utf8`.
+ */
+inline bool utf8 = false;
+
+/**
+ * Whether a byte may be part of a word, with the arithmetic of ScalarKernel:
+ * an ASCII letter or, with `Utf8`, any byte of a multi-byte sequence.
+ */
+template <bool Utf8>
+static inline auto is_word_byte(const char c) -> bool {
+    return static_cast<unsigned char>((c | 0x20) - 'a') < 26 || (Utf8 && (c & 0x80));
+}
+
+/**
+ * is_word_byte() in the mode of `--utf8`.
+ */
+static inline auto is_letter(const char c) -> bool {
+    return utf8 ? is_word_byte<true>(c) : is_word_byte<false>(c);
+}
+
+enum class kernel_t { scalar, sse2, avx2 };
+
+/**
+ * Picks the widest kernel the running CPU supports.
+ */
+static inline auto detect_kernel(void) -> kernel_t {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return kernel_t::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return kernel_t::sse2;
+#endif
+    return kernel_t::scalar;
+}
+
+/**
+ * The kernel used by scan_words(). Defaults to detect_kernel(); may be
+ * narrowed from the command line to compare the paths.
+ */
+inline kernel_t kernel = detect_kernel();
+
+/**
+ * Mask of bits [0, i], for i in [0, 63].
+ */
+static inline auto mask_through(const unsigned i) -> std::uint64_t {
+    return ~std::uint64_t{0} >> (63 - i);
+}
+
+/**
+ * Block tokenizer behind scan_words(), instantiated once per kernel and mode.
+ *
+ * Words are found from transitions in the letter mask: a word starts where a
+ * letter follows a non-letter and ends where a non-letter follows a letter.
+ * Each word is reported with the number of the line holding the byte that
+ * terminates it, which is the popcount of the newlines up to and including
+ * that byte; this matches the historical byte-at-a-time reader, where the
+ * terminating '\n' is consumed together with the word.
+ *
+ * With `Utf8`, bytes 0x80 and above count as letters too, so a word is a
+ * run of ASCII letters and multi-byte sequences for scan_words() to split.
+ */
+template <typename Kernel, bool Utf8, typename Emit>
+static auto scan_blocks(const char *begin, const char *end, const bool eof, std::size_t &line, Emit &&emit) -> const char * {
+    const char *word = nullptr;
+    std::uint64_t carry = 0;
+
+    const auto step = [&](const char *base, const masks_t masks, std::uint64_t valid) {
+        const std::uint64_t shifted = (masks.letters << 1) | carry;
+        std::uint64_t transitions = (masks.letters ^ shifted) & valid;
+        while (transitions) {
+            const unsigned i = std::countr_zero(transitions);
+            if (masks.letters >> i & 1)
+                word = base + i;
+            else
+                emit(std::string_view(word, base + i - word), line + std::popcount(masks.newlines & mask_through(i)));
+            transitions &= transitions - 1;
+        }
+        line += std::popcount(masks.newlines);
+    };
+
+    const char *p = begin;
+    for (; end - p >= 64; p += 64) {
+        masks_t masks = Kernel::classify(p);
+        if constexpr (Utf8)
+            masks.letters |= masks.high;
+        step(p, masks, ~std::uint64_t{0});
+        carry = masks.letters >> 63;
+    }
+    if (p != end) {
+        alignas(64) char tail[64] = {};
+        const std::size_t length = end - p;
+        std::memcpy(tail, p, length);
+        masks_t masks = Kernel::classify(tail);
+        if constexpr (Utf8)
+            masks.letters |= masks.high;
+        step(p, masks, (std::uint64_t{1} << length) - 1);
+        carry = masks.letters >> (length - 1) & 1;
+    }
+
+    if (!carry)
+        return end;
+    if (!eof)
+        return word;
+    emit(std::string_view(word, end - word), line);
+    return end;
+}
+
+/**
+ * Runs scan_blocks() with the given kernel.
+ */
+template <bool Utf8, typename Emit>
+static inline auto scan_runs(const char *begin, const char *end, const bool eof, std::size_t &line, Emit &&emit, const kernel_t use_kernel) -> const char * {
+    switch (use_kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+    case kernel_t::avx2:
+        return scan_blocks<Avx2Kernel, Utf8>(begin, end, eof, line, emit);
+    case kernel_t::sse2:
+        return scan_blocks<Sse2Kernel, Utf8>(begin, end, eof, line, emit);
+#endif
+    default:
+        return scan_blocks<ScalarKernel, Utf8>(begin, end, eof, line, emit);
+    }
+}
+
+/**
+ * Tokenizes a contiguous buffer.
+ *
+ * Calls `emit(word, line)` for every maximal run of ASCII letters in
+ * [begin, end), in order. The views point into the buffer and keep the
+ * original letter case. `line` is the number of the line at `begin` and is
+ * advanced past every '\n' in the buffer.
+ *
+ * In UTF-8 mode, runs of ASCII letters and non-ASCII bytes are found by the
+ * same kernels. A run without a non-ASCII byte is a word as above, so ASCII
+ * text stays on the fast path; any other run is decoded and split by
+ * unicode::split(), and its words are passed already case folded, in a
+ * buffer that is only valid during the call. A word that a non-letter ends
+ * inside the run gets the line of that code point rather than the line of
+ * the byte after the run.
+ *
+ * @param begin Start of the buffer; must not be in the middle of a word.
+ * @param end End of the buffer.
+ * @param eof Whether the input ends at `end`. If not, a word touching `end`
+ *            may continue in the next buffer and is not emitted.
+ * @param line The current line number, updated in place.
+ * @param emit Callback receiving each word and its line number.
+ * @param use_kernel The kernel, `kernel` by default.
+ * @param use_utf8 Whether to segment UTF-8 text, `utf8` by default.
+ * @return The start of the unfinished word at the end of the buffer, or `end`.
+ */
+template <typename Emit>
+static inline auto scan_words(const char *begin, const char *end, const bool eof, std::size_t &line, Emit &&emit, const kernel_t use_kernel = kernel, const bool use_utf8 = utf8) -> const char * {
+    if (!use_utf8)
+        return scan_runs<false>(begin, end, eof, line, emit, use_kernel);
+
+    std::string folded;
+    return scan_runs<true>(begin, end, eof, line, [&](const std::string_view run, const std::size_t at) {
+        if (!unicode::has_non_ascii(run)) {
+            emit(run, at);
+            return;
+        }
+        const bool newline = run.data() + run.size() != end && run.data()[run.size()] == '\n';
+        unicode::split(run, folded, [&](const std::string_view word, const bool last) {
+            emit(word, last || !newline ? at : at - 1);
+        });
+    }, use_kernel);
+}
+
+} // namespace simd
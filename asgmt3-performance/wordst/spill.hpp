@@ -0,0 +1,477 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "io.hpp"
+#include "report.hpp"
+#include "word_info.hpp"
+
+/**
+ * The memory limit of a Spilling engine in bytes, set by `--mem-limit`.
+ */
+inline std::size_t mem_limit = SIZE_MAX;
+
+/**
+ * Picks the first of the heads of k sorted sources in about log2(k)
+ * comparisons per item.
+ *
+ * A tournament tree with the sources as leaves: every inner node keeps the
+ * loser of the match played there and node 0 the overall winner. Once the
+ * winner's source has advanced, only the matches on the path from its leaf
+ * to the root are replayed, each against the loser stored there, so unlike
+ * a heap no sibling has to be compared.
+ *
+ * @tparam Beats `beats(a, b)` is whether the head of source `a` goes before
+ *               that of source `b`. It must be a strict total order, with an
+ *               exhausted source after every other one.
+ */
+template <typename Beats>
+class LoserTree {
+  private:
+    std::vector<std::size_t> tree;
+    Beats beats;
+
+    /**
+     * Plays the matches below a node, whose leaves are the nodes from k on.
+     *
+     * @return The winner of the subtree.
+     */
+    auto build(const std::size_t node) -> std::size_t {
+        if (node >= tree.size())
+            return node - tree.size();
+        const std::size_t a = build(2 * node), b = build(2 * node + 1);
+        const bool first = beats(a, b);
+        tree[node] = first ? b : a;
+        return first ? a : b;
+    }
+
+  public:
+    /**
+     * @param k The number of sources, at least 1.
+     * @param beats The order of the sources' heads.
+     */
+    LoserTree(const std::size_t k, Beats beats) : tree(k), beats(std::move(beats)) {
+        tree[0] = build(1);
+    }
+
+    /**
+     * The source whose head goes first.
+     */
+    auto top(void) const -> std::size_t {
+        return tree[0];
+    }
+
+    /**
+     * Replays the matches of the winner once its source has advanced.
+     */
+    auto replay(void) -> void {
+        std::size_t winner = tree[0];
+        for (std::size_t node = (winner + tree.size()) / 2; node; node /= 2)
+            if (beats(tree[node], winner))
+                std::swap(tree[node], winner);
+        tree[0] = winner;
+    }
+};
+
+/**
+ * A sorted run of words on disk, written once and then read back once in
+ * order.
+ *
+ * A record is the word length (4 bytes), the word, the count and the last
+ * line (8 bytes each), the length of the encoded line list (4 bytes) and the
+ * list as Postings encodes it. The file is created in $TMPDIR, /tmp by
+ * default, and unlinked straight away, so it goes away with the process.
+ */
+class Run {
+  private:
+    std::FILE *fp = nullptr;
+    std::vector<std::uint8_t> lines;
+    bool failed = false;
+
+    auto get(void *bytes, const std::size_t length) -> bool {
+        return std::fread(bytes, 1, length, fp) == length;
+    }
+
+  public:
+    std::string word;
+    WordInfo info{0, {}};
+
+    /**
+     * Creates the file of the run; ok() tells whether that worked.
+     */
+    Run() {
+        const char *dir = std::getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") + "/wordst.XXXXXX";
+        const int fd = mkstemp(path.data());
+        if (fd < 0)
+            return;
+        unlink(path.c_str());
+        fp = fdopen(fd, "w+b");
+        if (!fp)
+            close(fd);
+    }
+
+    Run(Run &&other) noexcept : fp(std::exchange(other.fp, nullptr)), lines(std::move(other.lines)), failed(other.failed), word(std::move(other.word)), info(other.info) {}
+
+    auto operator=(Run &&other) noexcept -> Run & {
+        std::swap(fp, other.fp);
+        lines.swap(other.lines);
+        std::swap(failed, other.failed);
+        word.swap(other.word);
+        std::swap(info, other.info);
+        return *this;
+    }
+
+    /**
+     * Destructor for Run. Closing the file frees its blocks.
+     */
+    ~Run(void) {
+        if (fp)
+            std::fclose(fp);
+    }
+
+    /**
+     * Whether the file exists and every read and write so far succeeded.
+     */
+    auto ok(void) const -> bool {
+        return fp && !failed && !std::ferror(fp);
+    }
+
+    /**
+     * Appends a record, after the records written so far.
+     */
+    auto write(const std::string_view word, const WordInfo &info) -> void {
+        if (!fp)
+            return;
+        const std::uint32_t length = word.size(), bytes = info.lines.bytes();
+        const std::uint64_t fields[2] = {info.count, info.lines.back()};
+        std::fwrite(&length, sizeof(length), 1, fp);
+        std::fwrite(word.data(), 1, word.size(), fp);
+        std::fwrite(fields, sizeof(fields), 1, fp);
+        std::fwrite(&bytes, sizeof(bytes), 1, fp);
+        std::fwrite(info.lines.data(), 1, bytes, fp);
+    }
+
+    /**
+     * Ends writing and goes back to the first record.
+     *
+     * @return ok() once the written records are flushed.
+     */
+    auto rewind(void) -> bool {
+        return ok() && std::fflush(fp) == 0 && std::fseek(fp, 0, SEEK_SET) == 0;
+    }
+
+    /**
+     * Reads the next record into `word` and `info`, whose line list stays
+     * valid until the next call.
+     *
+     * @return false at the end of the run or if the record is cut short,
+     *         which also clears ok().
+     */
+    auto next(void) -> bool {
+        std::uint32_t length, bytes;
+        std::uint64_t fields[2] = {0, 0};
+        if (!fp || !get(&length, sizeof(length)))
+            return false;
+        word.resize(length);
+        failed = !get(word.data(), length) || !get(fields, sizeof(fields)) || !get(&bytes, sizeof(bytes));
+        if (!failed) {
+            lines.resize(bytes);
+            failed = !get(lines.data(), bytes);
+        }
+        info = WordInfo{fields[0], Postings::borrow(lines.data(), failed ? 0 : bytes, fields[1])};
+        return !failed;
+    }
+};
+
+/**
+ * Reads runs back in the order `before` sorts their records, calling
+ * `emit(run)` for each record while it is the head of its run. Records that
+ * compare equal come in run order. `emit` returns whether to go on; once it
+ * returns false, no further record is decoded.
+ *
+ * @return Whether every run read so far was read in full.
+ */
+template <typename Before, typename Emit>
+static inline auto merge_runs(std::vector<Run> &runs, Before &&before, Emit &&emit) -> bool {
+    if (runs.empty())
+        return true;
+    std::vector<bool> done(runs.size());
+    for (std::size_t i = 0; i < runs.size(); ++i)
+        if (!runs[i].rewind())
+            return false;
+        else
+            done[i] = !runs[i].next();
+
+    const auto beats = [&](const std::size_t a, const std::size_t b) {
+        if (done[a] || done[b])
+            return !done[a];
+        return before(runs[a], runs[b]) || (!before(runs[b], runs[a]) && a < b);
+    };
+    LoserTree tree(runs.size(), beats);
+    for (std::size_t i; !done[i = tree.top()]; tree.replay()) {
+        if (!emit(runs[i]))
+            break;
+        done[i] = !runs[i].next();
+    }
+    for (const Run &run : runs)
+        if (!run.ok())
+            return false;
+    return true;
+}
+
+/**
+ * Reads runs sorted by word back as one list, calling `emit(word, info)`
+ * once per distinct word in ascending order. The WordInfo of a word absorbs
+ * those of every run in run order, as WordInfo::absorb() would merge the
+ * engines of consecutive parts of the input. `emit` may take the WordInfo
+ * over by leaving an empty one in its place; otherwise it is released after
+ * the call.
+ *
+ * @return Whether every run was read in full.
+ */
+template <typename Emit>
+static inline auto merge_words(std::vector<Run> &runs, Emit &&emit) -> bool {
+    std::string word;
+    WordInfo merged{0, {}};
+    bool any = false;
+    const auto flush = [&] {
+        emit(std::string_view(word), merged);
+        merged.lines.release();
+        merged = WordInfo{0, {}};
+    };
+    const bool ok = merge_runs(runs, [](const Run &a, const Run &b) { return a.word < b.word; }, [&](const Run &run) {
+        if (any && run.word != word)
+            flush();
+        if (merged.count == 0)
+            word = run.word;
+        merged.absorb(run.info);
+        any = true;
+        return true;
+    });
+    if (any)
+        flush();
+    return ok;
+}
+
+/**
+ * Counting engine that spills to disk to stay within `mem_limit` bytes.
+ *
+ * Words are counted by `Engine` until its tables reach a third of the
+ * limit, as a table may double past that before the next check and the
+ * reader and the process need a few MiB of their own. The words are
+ * then written out as a Run straight from the engine with for_each(), so no
+ * copy of them is made, and the engine starts over empty. The
+ * line numbers need no shifting, as every part is counted with the lines of
+ * the whole input. Once there are `fan_in` runs, they are merged into one,
+ * so no more than `fan_in` files are ever open. Line lists that outgrow
+ * their WordInfo are estimated at one byte per word, as most lines are
+ * less than 128 after the previous one.
+ *
+ * print() merges the runs by word and ranks them in a second pass, see
+ * there, with the same result as printStatis() on the engine of the whole
+ * input. As long as nothing was spilled, the engine is simply at hand.
+ *
+ * The input should not be mapped, as its pages would count against the
+ * limit as well.
+ *
+ * @tparam Engine Trie, HashTable or Utf8HashTable.
+ */
+template <typename Engine>
+class Spilling {
+  public:
+    static constexpr std::size_t fan_in = 64;
+
+  private:
+    Engine counter;
+    std::vector<Run> runs;
+    std::size_t tokens = 0;
+    bool failed = false;
+
+    /**
+     * Folds the runs into a single one, if there are `fan_in` of them.
+     */
+    auto compact(void) -> void {
+        if (runs.size() < fan_in)
+            return;
+        Run merged;
+        failed |= !merge_words(runs, [&](const std::string_view word, const WordInfo &info) {
+            merged.write(word, info);
+        });
+        runs.clear();
+        runs.push_back(std::move(merged));
+    }
+
+    /**
+     * Writes the words of the engine to a new run and empties the engine.
+     */
+    auto spill(void) -> void {
+        Run run;
+        counter.for_each([&](const std::string_view word, const WordInfo &info) {
+            run.write(word, info);
+        });
+        failed |= !run.ok();
+        runs.push_back(std::move(run));
+        counter = Engine();
+        tokens = 0;
+        compact();
+    }
+
+  public:
+    /**
+     * Does nothing: sizing the engine from the whole input would defeat the
+     * limit.
+     */
+    auto reserve(const size_t) -> void {}
+
+    /**
+     * Reports the memory of the engine now in memory.
+     */
+    auto memory(void) const -> MemoryStats {
+        return counter.memory();
+    }
+
+    /**
+     * Counts the words of the engine now in memory. See Trie::census().
+     */
+    auto census(void) const -> Census {
+        return counter.census();
+    }
+
+    /**
+     * The engine now in memory, which holds every word until the first
+     * spill.
+     */
+    auto engine(void) const -> const Engine & {
+        return counter;
+    }
+
+    /**
+     * The number of runs on disk.
+     */
+    auto spilled(void) const -> std::size_t {
+        return runs.size();
+    }
+
+    /**
+     * Whether no run failed to be written or read.
+     */
+    auto ok(void) const -> bool {
+        return !failed;
+    }
+
+    /**
+     * Inserts a word into the engine. Every 1024 words, the engine is
+     * spilled if it has outgrown a third of the limit.
+     *
+     * @param word The letters of the word.
+     * @param line The line number where the word occurs.
+     * @tparam Cap The number of lines to record, see WordInfo::add().
+     */
+    template <std::size_t Cap = dynamic_lines>
+    auto insert(const std::string_view word, const size_t line) -> void {
+        counter.template insert<Cap>(word, line);
+        if ((++tokens & 0x3FF) == 0 && !failed && counter.memory().reserved + (max_lines > limit ? tokens : 0) > mem_limit / 3)
+            spill();
+    }
+
+    /**
+     * Prints the table of every word counted, after at least one spill.
+     *
+     * The engine is spilled one last time and the runs are merged by word
+     * with a loser tree. The merged words are gathered in batches of about
+     * half the limit, and every batch is ranked by rankStatis(), which needs
+     * them in ascending order as they come. The batch is reserved once, so
+     * it never holds two copies while growing, and counts its entries, the
+     * two words per entry that rankStatis() allocates, and the words and line
+     * lists that live on the heap. A single batch is printed
+     * directly; otherwise every batch becomes a run in rank order and these
+     * runs are merged by count descending and then word ascending, printing
+     * each row as it comes. The runs are consumed.
+     *
+     * @param fp The stream to print to.
+     * @param top The number of rows to print.
+     * @return false if a run could not be written or read back.
+     */
+    auto print(std::FILE *fp, const std::size_t top = SIZE_MAX) -> bool {
+        spill();
+        std::vector<Run> ranked;
+        std::vector<std::pair<std::string, WordInfo>> batch;
+        constexpr std::size_t entry_bytes = sizeof(batch[0]) + 2 * sizeof(size_t);
+        if (mem_limit != SIZE_MAX)
+            batch.reserve(mem_limit / 2 / entry_bytes + 1);
+        std::size_t batch_bytes = 0;
+        const auto release = [&] {
+            for (auto &entry : batch)
+                entry.second.lines.release();
+            batch.clear();
+            batch_bytes = 0;
+        };
+        const auto rank = [&] {
+            Run run;
+            for (const size_t i : rankStatis(batch))
+                run.write(batch[i].first, batch[i].second);
+            release();
+            failed |= !run.ok();
+            ranked.push_back(std::move(run));
+            if (ranked.size() == fan_in) {
+                Run merged;
+                failed |= !merge_runs(ranked, by_rank, [&](const Run &run) {
+                    merged.write(run.word, run.info);
+                    return true;
+                });
+                ranked.clear();
+                ranked.push_back(std::move(merged));
+            }
+        };
+
+        failed |= !merge_words(runs, [&](const std::string_view word, WordInfo &info) {
+            batch_bytes += entry_bytes + (word.size() >= sizeof(std::string) / 2 ? word.size() + 1 : 0) + info.lines.heap_bytes();
+            batch.emplace_back(word, std::exchange(info, WordInfo{0, {}}));
+            if (batch_bytes > mem_limit / 2)
+                rank();
+        });
+        runs.clear();
+        if (failed) {
+            release();
+            return false;
+        }
+
+        if (ranked.empty()) {
+            std::vector<size_t> order = rankStatis(batch);
+            order.resize(std::min(order.size(), top));
+            printTable(batch, order, fp);
+            release();
+            return true;
+        }
+        if (!batch.empty())
+            rank();
+
+        ReportWriter report(fp);
+        std::size_t rows = 0;
+        failed |= !merge_runs(ranked, by_rank, [&](const Run &run) {
+            if (rows++ == top)
+                return false;
+            report.row(run.word, run.info);
+            return true;
+        });
+        return !failed;
+    }
+
+  private:
+    /**
+     * The order of printStatis(): count descending, then word ascending.
+     */
+    static auto by_rank(const Run &a, const Run &b) -> bool {
+        return a.info.count != b.info.count ? a.info.count > b.info.count : a.word < b.word;
+    }
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "word_info.hpp"
+
+class Trie {
+    friend class Index;
+
+  private:
+    /**
+     * A node of the Trie, 12 bytes.
+     *
+     * The children of a node are stored contiguously in `nodes`, in letter
+     * order, starting at `base`; bit c of `mask` is set if the child for
+     * letter 'a' + c exists, so the child is at `base` plus the number of set
+     * bits below c. Only nodes that end a word own a WordInfo, kept in the
+     * dense `infos` side table at index `info - 1`.
+     */
+    struct node_t {
+        std::uint32_t mask;
+        std::uint32_t base;
+        std::uint32_t info;
+    };
+    static constexpr std::uint32_t root = 0;
+    Arena<node_t> nodes;
+    Arena<WordInfo> infos;
+    std::array<std::vector<std::uint32_t>, 27> free_blocks;
+    std::size_t copied = 0;
+
+    /**
+     * Finds the child of a node for a letter, creating it if needed.
+     *
+     * A new child does not fit in the existing child block, so the block is
+     * copied into one that is one node larger, with the new node inserted at
+     * its letter's position. Released blocks are kept in per-size free lists
+     * and reused by later growth, and so is the tail of an arena chunk that is
+     * too short for a new block, since a block never spans two chunks.
+     *
+     * @param p The index of the parent node.
+     * @param c The letter of the child, 0 for 'a' through 25 for 'z'.
+     * @return The index of the child node.
+     */
+    auto child(const std::uint32_t p, const unsigned c) -> std::uint32_t {
+        const std::uint32_t bit = std::uint32_t{1} << c;
+        const std::uint32_t rank = std::popcount(nodes[p].mask & (bit - 1));
+        if (nodes[p].mask & bit)
+            return nodes[p].base + rank;
+
+        const std::uint32_t size = std::popcount(nodes[p].mask);
+        std::uint32_t base;
+        if (!free_blocks[size + 1].empty()) {
+            base = free_blocks[size + 1].back();
+            free_blocks[size + 1].pop_back();
+        } else {
+            if (const std::size_t room = nodes.room(); room < size + 1 && room)
+                free_blocks[room].push_back(nodes.allocate(room));
+            base = nodes.allocate(size + 1);
+        }
+
+        const node_t *old = &nodes[nodes[p].base];
+        node_t *block = &nodes[base];
+        std::copy_n(old, rank, block);
+        block[rank] = node_t{0, 0, 0};
+        std::copy_n(old + rank, size - rank, block + rank + 1);
+        if (size)
+            free_blocks[size].push_back(nodes[p].base);
+        copied += size * sizeof(node_t);
+
+        nodes[p].mask |= bit;
+        nodes[p].base = base;
+        return base + rank;
+    }
+
+    /**
+     * Returns the WordInfo of a node, creating an empty one if needed.
+     */
+    auto info(const std::uint32_t p) -> WordInfo & {
+        if (!nodes[p].info)
+            nodes[p].info = infos.push_back(WordInfo{0, {}}) + 1;
+        return infos[nodes[p].info - 1];
+    }
+
+  public:
+    /**
+     * Constructor for the Trie class.
+     *
+     * Initializes the Trie with a single root node at index 0 of the nodes
+     * arena. The root is never moved, since it is nobody's child.
+     */
+    Trie() {
+        nodes.allocate(1);
+    }
+
+    Trie(Trie &&) = default;
+    auto operator=(Trie &&) -> Trie & = default;
+
+    /**
+     * Destructor for Trie.
+     *
+     * Frees the line lists that outgrew their WordInfo.
+     */
+    ~Trie(void) {
+        for (std::size_t i = 0; i < infos.size(); ++i)
+            infos[i].lines.release();
+    }
+
+    /**
+     * Maps the arenas up front for an input of the given size.
+     *
+     * Natural-language text rarely creates more than one node per 16 bytes of
+     * input or one distinct word per 64 bytes; only address space is taken
+     * until the nodes are actually used.
+     *
+     * @param bytes The size of the input.
+     */
+    auto reserve(const size_t bytes) -> void {
+        nodes.reserve(bytes / 16);
+        infos.reserve(bytes / 64);
+    }
+
+    /**
+     * Reports the bytes mapped for nodes and WordInfo, and the bytes of nodes
+     * copied when child blocks grew.
+     */
+    auto memory(void) const -> MemoryStats {
+        return MemoryStats{nodes.bytes_reserved() + infos.bytes_reserved(), copied};
+    }
+
+    /**
+     * Counts the words, their occurrences and the nodes, free ones included.
+     * Walks every WordInfo, so it is meant for reporting only.
+     */
+    auto census(void) const -> Census {
+        std::size_t tokens = 0, postings = 0;
+        for (std::size_t i = 0; i < infos.size(); ++i)
+            tokens += infos[i].count, postings += infos[i].lines.heap_bytes();
+        return Census{infos.size(), tokens, nodes.size(), postings};
+    }
+
+    /**
+     * Inserts a word into the Trie and records its occurrence line.
+     *
+     * Traverses or creates nodes corresponding to each character in the word.
+     * If the word does not exist in the Trie, it creates a path for it.
+     * Once the word is inserted, it updates the WordInfo for the terminal node
+     * to increase the occurrence count and store the line number, if within limits.
+     *
+     * Letters are folded to lowercase on the fly, so the word may be a view
+     * straight into the input in its original case.
+     *
+     * @param word The ASCII letters to be inserted into the Trie.
+     * @param line The line number where the word occurs.
+     * @tparam Cap The number of lines to record, see WordInfo::add().
+     */
+    template <std::size_t Cap = dynamic_lines>
+    auto insert(const std::string_view word, const size_t line) -> void {
+        std::uint32_t p = root;
+        for (char ch : word)
+            p = child(p, (ch | 0x20) - 'a');
+        info(p).add<Cap>(line);
+    }
+
+    /**
+     * Adds a constant to every recorded line number.
+     *
+     * Used to turn line numbers counted from the start of a chunk into line
+     * numbers counted from the start of the file.
+     *
+     * @param offset The number of lines before the chunk.
+     */
+    auto shift_lines(const size_t offset) -> void {
+        for (size_t j = 0; j < infos.size(); ++j)
+            infos[j].lines.shift(offset);
+    }
+
+    /**
+     * Merges the words of another Trie into this one.
+     *
+     * Walks both tries in lockstep, creating missing nodes in this Trie, and
+     * absorbs the WordInfo of every word in `other`. `other` must hold the
+     * words of input that follows the input of this Trie, so the recorded
+     * line numbers stay the first ones in input order.
+     *
+     * @param other The Trie to merge; it is left unchanged.
+     */
+    auto merge(const Trie &other) -> void {
+        auto walk = [&](std::uint32_t p, std::uint32_t q, auto &&walk) -> void {
+            if (other.nodes[q].info)
+                info(p).absorb(other.infos[other.nodes[q].info - 1]);
+            std::uint32_t q_child = other.nodes[q].base;
+            for (std::uint32_t mask = other.nodes[q].mask; mask; mask &= mask - 1)
+                walk(child(p, std::countr_zero(mask)), q_child++, walk);
+        };
+
+        walk(root, root, walk);
+    }
+
+    /**
+     * Calls `visit(word, info)` for every word in ascending order, without
+     * copying any of them.
+     *
+     * Performs a depth-first search of the Trie; each word is reconstructed
+     * in a path buffer, which stays valid only during the call.
+     *
+     * @param visit Takes a std::string_view and a const WordInfo &.
+     */
+    template <typename Visit>
+    auto for_each(Visit &&visit) const -> void {
+        std::string current;
+        auto search = [&](std::uint32_t p, auto &&search) -> void {
+            if (nodes[p].info)
+                visit(std::string_view(current), infos[nodes[p].info - 1]);
+            std::uint32_t q = nodes[p].base;
+            for (std::uint32_t mask = nodes[p].mask; mask; mask &= mask - 1) {
+                current.push_back(std::countr_zero(mask) + 'a');
+                search(q++, search);
+                current.pop_back();
+            }
+        };
+
+        search(root, search);
+    }
+
+    /**
+     * Retrieves all words stored in the Trie along with their associated WordInfo.
+     *
+     * Collects the words of for_each(), including occurrence count and line
+     * numbers, in ascending order.
+     *
+     * @return A vector of pairs containing each word and its WordInfo.
+     */
+    auto get_all(void) const -> std::vector<std::pair<std::string, WordInfo>> {
+        std::vector<std::pair<std::string, WordInfo>> result;
+        result.reserve(infos.size());
+        for_each([&](const std::string_view word, const WordInfo &info) {
+            result.emplace_back(word, info);
+        });
+        return result;
+    }
+
+    /**
+     * Retrieves the `k` most frequent words, best first.
+     *
+     * Walks the Trie with for_each(), but a word is only copied out of the
+     * path buffer if it beats the worst of the words kept so far. The DFS
+     * visits words in ascending order, so a word tied with the worst kept
+     * one never makes the cut and costs a single integer comparison.
+     *
+     * @param k The number of words to return.
+     * @return Up to `k` pairs of a word and its WordInfo, ranked by count
+     *         descending and then by word ascending.
+     */
+    auto get_top(const size_t k) const -> std::vector<std::pair<std::string, WordInfo>> {
+        TopK top(k, infos.size());
+        for_each([&](const std::string_view word, const WordInfo &info) {
+            top.offer(word, info);
+        });
+        return top.take();
+    }
+};
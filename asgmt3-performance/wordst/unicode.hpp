@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "unicode_tables.hpp"
+
+namespace unicode {
+
+/**
+ * Bits of the properties table, see gen_unicode_tables.py.
+ */
+enum : std::uint8_t { word = 1, zero_width = 2, wide = 4 };
+
+/**
+ * What decode() returns for a byte that does not start a valid sequence.
+ */
+static constexpr std::uint32_t invalid = 0xFFFFFFFF;
+
+/**
+ * Decodes the UTF-8 sequence at `p` and advances `p` past it.
+ *
+ * Stray continuation bytes, overlong forms, surrogates, code points past
+ * U+10FFFF and sequences cut off by `end` decode to `invalid` and consume a
+ * single byte, so decoding resynchronizes on the next lead byte.
+ */
+static inline auto decode(const char *&p, const char *end) -> std::uint32_t {
+    const unsigned char lead = *p;
+    if (lead < 0x80)
+        return ++p, lead;
+    std::ptrdiff_t length;
+    std::uint32_t cp, least;
+    if ((lead & 0xE0) == 0xC0)
+        length = 2, cp = lead & 0x1F, least = 0x80;
+    else if ((lead & 0xF0) == 0xE0)
+        length = 3, cp = lead & 0x0F, least = 0x800;
+    else if ((lead & 0xF8) == 0xF0)
+        length = 4, cp = lead & 0x07, least = 0x10000;
+    else
+        return ++p, invalid;
+    if (end - p < length)
+        return ++p, invalid;
+    for (std::ptrdiff_t i = 1; i < length; ++i) {
+        const unsigned char next = p[i];
+        if ((next & 0xC0) != 0x80)
+            return ++p, invalid;
+        cp = cp << 6 | (next & 0x3F);
+    }
+    if (cp < least || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000))
+        return ++p, invalid;
+    p += length;
+    return cp;
+}
+
+/**
+ * Appends the UTF-8 encoding of a valid code point.
+ */
+static inline auto encode(const std::uint32_t cp, std::string &out) -> void {
+    if (cp < 0x80)
+        out.push_back(cp);
+    else if (cp < 0x800)
+        out.push_back(0xC0 | cp >> 6), out.push_back(0x80 | (cp & 0x3F));
+    else if (cp < 0x10000)
+        out.push_back(0xE0 | cp >> 12), out.push_back(0x80 | (cp >> 6 & 0x3F)), out.push_back(0x80 | (cp & 0x3F));
+    else
+        out.push_back(0xF0 | cp >> 18), out.push_back(0x80 | (cp >> 12 & 0x3F)), out.push_back(0x80 | (cp >> 6 & 0x3F)), out.push_back(0x80 | (cp & 0x3F));
+}
+
+/**
+ * Looks up the word, zero_width and wide bits of a code point.
+ */
+static inline auto properties(const std::uint32_t cp) -> std::uint8_t {
+    return property_blocks[property_index[cp >> property_shift] << property_shift | (cp & ((1u << property_shift) - 1))];
+}
+
+/**
+ * Maps a code point to its simple case folding.
+ */
+static inline auto fold(const std::uint32_t cp) -> std::uint32_t {
+    return cp + fold_blocks[fold_index[cp >> fold_shift] << fold_shift | (cp & ((1u << fold_shift) - 1))];
+}
+
+/**
+ * Checks for a byte of 0x80 or above, 8 bytes at a time.
+ */
+static inline auto has_non_ascii(const std::string_view text) -> bool {
+    std::size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8) {
+        std::uint64_t v;
+        std::memcpy(&v, text.data() + i, 8);
+        if (v & 0x8080808080808080)
+            return true;
+    }
+    for (; i < text.size(); ++i)
+        if (text[i] & 0x80)
+            return true;
+    return false;
+}
+
+/**
+ * Counts the terminal columns a UTF-8 string takes: 2 for wide characters,
+ * 0 for combining marks and format characters, 1 for anything else,
+ * including bytes that do not decode.
+ */
+static inline auto width(const std::string_view text) -> std::size_t {
+    if (!has_non_ascii(text))
+        return text.size();
+    std::size_t columns = 0;
+    for (const char *p = text.data(), *end = p + text.size(); p != end;) {
+        const std::uint32_t cp = decode(p, end);
+        const std::uint8_t bits = cp == invalid ? 0 : properties(cp);
+        columns += bits & zero_width ? 0 : bits & wide ? 2 : 1;
+    }
+    return columns;
+}
+
+/**
+ * Splits a run of ASCII letters and non-ASCII bytes into words.
+ *
+ * Code points of general category L* or M* are word characters; any other
+ * code point, and any byte that does not decode, ends the current word.
+ * Every word is case folded into `folded` and passed to `emit(word, last)`,
+ * where `last` tells whether the word reaches the end of the run.
+ *
+ * @param run The run, as found by the tokenizer.
+ * @param folded Scratch space for the folded word.
+ * @param emit Callback receiving each word.
+ */
+template <typename Emit>
+static inline auto split(const std::string_view run, std::string &folded, Emit &&emit) -> void {
+    folded.clear();
+    for (const char *p = run.data(), *end = p + run.size(); p != end;) {
+        const std::uint32_t cp = decode(p, end);
+        if (cp != invalid && properties(cp) & word)
+            encode(fold(cp), folded);
+        else if (!folded.empty()) {
+            emit(std::string_view(folded), false);
+            folded.clear();
+        }
+    }
+    if (!folded.empty())
+        emit(std::string_view(folded), true);
+}
+
+} // namespace unicode
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hash_table.hpp"
+#include "report.hpp"
+#include "simd.hpp"
+#include "trie.hpp"
+#include "word_info.hpp"
+
+/**
+ * Counts the words of input handed over in chunks, for programs that
+ * already hold the text in memory.
+ *
+ * Every chunk is tokenized in place by simd::scan_words(). Chunks may be cut
+ * anywhere, even inside a word or a UTF-8 sequence: only the unfinished word
+ * at the end of a chunk is copied, into a carry buffer that the next chunk
+ * completes. Lines are numbered from 1 across all chunks, so the results are
+ * those of counting the concatenated input in one go, as the command line
+ * does.
+ *
+ * Counting reads no process-wide setting: the kernel is given to the
+ * constructor, UTF-8 mode follows from the engine and the number of lines
+ * kept per word is `Cap`, so counters with different settings can live side
+ * by side and count on threads of their own. Only print() follows
+ * `report_format` and `--utf8` padding, as the command line does.
+ *
+ * Typical use:
+ *
+ *     WordCounter<> counter;
+ *     for (std::span<const char> chunk : chunks)
+ *         counter.feed(chunk);
+ *     counter.finish();
+ *     counter.visit([](const std::string_view word, const WordInfo &info) { ... });
+ *
+ * @tparam Engine Trie, HashTable or Utf8HashTable, which counts UTF-8 words.
+ * @tparam Cap The number of lines to record per word, see WordInfo::add().
+ */
+template <typename Engine = Trie, std::size_t Cap = limit>
+class WordCounter {
+  public:
+    static constexpr bool utf8 = std::is_same_v<Engine, Utf8HashTable>;
+
+    static_assert(utf8 || std::is_same_v<Engine, Trie> || std::is_same_v<Engine, HashTable>, "WordCounter counts with Trie, HashTable or Utf8HashTable");
+
+  private:
+    Engine counter;
+    simd::kernel_t kernel;
+    std::string carry;
+    std::size_t line = 1;
+    bool finished = false;
+
+    /**
+     * Counts the words of a buffer that starts outside a word.
+     *
+     * @return The start of the unfinished word at `end`, or `end`.
+     */
+    auto scan(const char *begin, const char *end, const bool eof) -> const char * {
+        return simd::scan_words(begin, end, eof, line, [&](const std::string_view word, const std::size_t at) {
+            counter.template insert<Cap>(word, at);
+        }, kernel, utf8);
+    }
+
+  public:
+    /**
+     * @param kernel The tokenizer kernel, the widest supported by default.
+     */
+    explicit WordCounter(const simd::kernel_t kernel = simd::detect_kernel()) : kernel(kernel) {}
+
+    /**
+     * Counts the words of the next chunk of input.
+     *
+     * A word still open from the previous chunk is completed first, up to
+     * and including the byte that ends it, so it gets the line it would get
+     * in one contiguous buffer. The chunk is not kept after the call.
+     *
+     * @param chunk The bytes following those of the previous call.
+     */
+    auto feed(const std::span<const char> chunk) -> void {
+        assert(!finished);
+        const char *begin = chunk.data(), *end = begin + chunk.size();
+        if (!carry.empty()) {
+            const char *stop = std::find_if_not(begin, end, simd::is_word_byte<utf8>);
+            carry.append(begin, stop + (stop != end));
+            if (stop == end)
+                return;
+            scan(carry.data(), carry.data() + carry.size(), false);
+            carry.clear();
+            begin = stop + 1;
+        }
+        const char *rest = scan(begin, end, false);
+        carry.assign(rest, end);
+    }
+
+    /**
+     * Ends the input, counting the word that touches its end if there is
+     * one. No chunk may be fed afterwards; calling it again does nothing.
+     */
+    auto finish(void) -> void {
+        if (finished)
+            return;
+        scan(carry.data(), carry.data() + carry.size(), true);
+        carry = std::string();
+        finished = true;
+    }
+
+    /**
+     * The number of the line the input has reached.
+     */
+    auto lines(void) const -> std::size_t {
+        return line;
+    }
+
+    /**
+     * The engine holding the counts, for get_top(), merge() or an Index.
+     */
+    auto engine(void) const -> const Engine & {
+        return counter;
+    }
+
+    /**
+     * Calls `visit(word, info)` for every word, ranked by count descending
+     * and then by word ascending, as printStatis() prints them. The word and
+     * the WordInfo are only valid during the call.
+     *
+     * @param visit Callback receiving each word and its WordInfo.
+     * @param jobs The number of threads to rank the words on.
+     */
+    template <typename Visit>
+    auto visit(Visit &&visit, const std::size_t jobs = 1) const -> void {
+        const std::vector<std::pair<std::string, WordInfo>> words = counter.get_all();
+        for (const std::size_t i : rankStatis(words, jobs))
+            visit(std::string_view(words[i].first), words[i].second);
+    }
+
+    /**
+     * Retrieves the `k` most frequent words, best first. See Trie::get_top().
+     */
+    auto top(const std::size_t k) const -> std::vector<std::pair<std::string, WordInfo>> {
+        return counter.get_top(k);
+    }
+
+    /**
+     * Prints the table of the command line to a stream.
+     *
+     * @param fp The stream to print to, stdout by default.
+     */
+    auto print(std::FILE *fp = stdout) const -> void {
+        const std::vector<std::pair<std::string, WordInfo>> words = counter.get_all();
+        printTable(words, rankStatis(words), fp);
+    }
+};
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * The number of lines recorded per word by default.
+ */
+constexpr std::size_t limit = 20;
+
+/**
+ * The number of lines recorded per word, set by `--max-lines`; SIZE_MAX
+ * records every line. insert() takes it as a template argument so the
+ * default can be compared against as a constant; `dynamic_lines` reads it
+ * at run time instead.
+ */
+inline std::size_t max_lines = limit;
+constexpr std::size_t dynamic_lines = 0;
+
+/**
+ * The recorded line numbers of a word, 32 bytes.
+ *
+ * Lines are stored as the differences between consecutive lines, the first
+ * one from 0, each as a LEB128 varint, so a line close to the previous one
+ * takes a single byte. Up to 16 bytes are kept in place; longer lists move
+ * to a malloc()ed block that doubles as it fills. Lines must be appended in
+ * non-decreasing order, which every reader and merge guarantees.
+ *
+ * A Postings is trivially copyable and copies share the heap block, so the
+ * engines free the blocks of their WordInfo side tables with release() and
+ * everything else, such as get_all() results, only reads them.
+ */
+class Postings {
+  public:
+    static constexpr std::size_t local_bytes = 16;
+
+    /**
+     * Appends a line number, not smaller than the last one.
+     */
+    auto push_back(const std::size_t line) -> void {
+        assert(line >= last);
+        std::size_t delta = line - last;
+        last = line;
+        if (delta < 0x80 && size != capacity()) [[likely]] {
+            storage()[size++] = delta;
+            return;
+        }
+        std::uint8_t bytes[10];
+        std::size_t n = 0;
+        for (; delta >= 0x80; delta >>= 7)
+            bytes[n++] = delta | 0x80;
+        bytes[n++] = delta;
+        write(bytes, n);
+    }
+
+    /**
+     * Appends the first `n` lines of another list, which must not start
+     * before the last line of this one. The differences after the first line
+     * are copied as they are.
+     */
+    auto append(const Postings &other, std::size_t n) -> void {
+        const std::uint8_t *p = other.data(), *end = p + other.size;
+        if (!n || p == end)
+            return;
+        std::size_t line = decode(p);
+        push_back(line);
+        const std::uint8_t *rest = p;
+        // No list holds SIZE_MAX / 2 lines, so such an `n` takes them all
+        // without decoding them.
+        if (n >= SIZE_MAX / 2) {
+            p = end;
+            line = other.last;
+        } else
+            while (--n && p != end)
+                line += decode(p);
+        write(rest, p - rest);
+        last = line;
+    }
+
+    /**
+     * Adds a constant to every line. Only the first difference changes.
+     */
+    auto shift(const std::size_t offset) -> void {
+        if (!size || !offset)
+            return;
+        const std::uint8_t *p = data();
+        const std::size_t first = decode(p);
+        const std::size_t old_length = p - data();
+        const std::size_t rest = size - old_length;
+        Postings head;
+        head.push_back(first + offset);
+        reserve(head.size + rest);
+        size = head.size + rest;
+        std::memmove(storage() + head.size, storage() + old_length, rest);
+        std::memcpy(storage(), head.local, head.size);
+        last += offset;
+    }
+
+    /**
+     * Calls `emit(line)` for every line, in order.
+     */
+    template <typename Emit>
+    auto for_each(Emit &&emit) const -> void {
+        std::size_t line = 0;
+        for (const std::uint8_t *p = data(), *end = p + size; p != end;)
+            emit(line += decode(p));
+    }
+
+    /**
+     * The encoded list, `bytes()` long, for saving it.
+     */
+    auto data(void) const -> const std::uint8_t * {
+        return size <= local_bytes ? local : heap;
+    }
+
+    auto bytes(void) const -> std::size_t {
+        return size;
+    }
+
+    auto back(void) const -> std::size_t {
+        return last;
+    }
+
+    /**
+     * Heap bytes held by the list, 0 while it is kept in place.
+     */
+    auto heap_bytes(void) const -> std::size_t {
+        return size <= local_bytes ? 0 : capacity();
+    }
+
+    /**
+     * Wraps an encoded list that lives elsewhere, such as in a mapped Index.
+     * The result may be read and appended to another list, but not be
+     * appended to or released itself.
+     */
+    static auto borrow(const std::uint8_t *bytes, const std::size_t size, const std::size_t last) -> Postings {
+        Postings postings;
+        postings.size = size;
+        postings.last = last;
+        if (size <= local_bytes)
+            std::memcpy(postings.local, bytes, size);
+        else
+            postings.heap = const_cast<std::uint8_t *>(bytes);
+        return postings;
+    }
+
+    /**
+     * Frees the heap block, if any, and empties the list.
+     */
+    auto release(void) -> void {
+        if (size > local_bytes)
+            std::free(heap);
+        *this = Postings();
+    }
+
+  private:
+    std::size_t last = 0;
+    std::size_t size = 0;
+    union {
+        std::uint8_t local[local_bytes] = {};
+        std::uint8_t *heap;
+    };
+
+    static auto decode(const std::uint8_t *&p) -> std::size_t {
+        std::size_t value = *p & 0x7F;
+        for (unsigned shift = 7; *p++ & 0x80; shift += 7)
+            value |= static_cast<std::size_t>(*p & 0x7F) << shift;
+        return value;
+    }
+
+    auto storage(void) -> std::uint8_t * {
+        return size <= local_bytes ? local : heap;
+    }
+
+    /**
+     * The bytes the current storage holds. A heap block is a power of two
+     * of at least 32 bytes and sizes only grow, so this never overstates it.
+     */
+    auto capacity(void) const -> std::size_t {
+        return size <= local_bytes ? local_bytes : std::bit_ceil(size);
+    }
+
+    /**
+     * Makes room for `n` bytes, moving the list to the heap or to a larger
+     * block. Callers set `size` to at most `n` before touching storage().
+     */
+    auto reserve(const std::size_t n) -> void {
+        if (n <= capacity())
+            return;
+        const std::size_t bytes = std::max<std::size_t>(std::bit_ceil(n), 2 * local_bytes);
+        if (size <= local_bytes) {
+            std::uint8_t *block = static_cast<std::uint8_t *>(std::malloc(bytes));
+            if (!block)
+                throw std::bad_alloc();
+            std::memcpy(block, local, size);
+            heap = block;
+        } else if (std::uint8_t *block = static_cast<std::uint8_t *>(std::realloc(heap, bytes)))
+            heap = block;
+        else
+            throw std::bad_alloc();
+    }
+
+    auto write(const std::uint8_t *bytes, const std::size_t n) -> void {
+        const std::size_t at = size;
+        reserve(at + n);
+        size = at + n;
+        std::memcpy(storage() + at, bytes, n);
+    }
+};
+
+struct WordInfo {
+    std::size_t count;
+    Postings lines;
+
+    /**
+     * Counts an occurrence and records its line if fewer than the cap are
+     * recorded so far.
+     *
+     * @param line The line number, not smaller than the last recorded one.
+     * @tparam Cap The cap, or `dynamic_lines` to read max_lines.
+     */
+    template <std::size_t Cap = dynamic_lines>
+    auto add(const std::size_t line) -> void {
+        if (++count <= (Cap == dynamic_lines ? max_lines : Cap))
+            lines.push_back(line);
+    }
+
+    /**
+     * Adds the occurrences of the same word from a later part of the input.
+     *
+     * The counts are summed and the line numbers of `other` are appended
+     * until `max_lines` lines are recorded, so the list stays in input order
+     * as long as `other` covers input after this one.
+     *
+     * @param other The WordInfo of the later part.
+     */
+    auto absorb(const WordInfo &other) -> void {
+        const std::size_t stored = std::min(count, max_lines);
+        lines.append(other.lines, max_lines - stored);
+        count += other.count;
+    }
+};
+
+static_assert(std::is_trivially_copyable_v<WordInfo>, "WordInfo lives in an Arena");
+
+/**
+ * Keeps the `k` best words of a stream, ranked by count descending and then
+ * by word ascending.
+ *
+ * Offering a word is one comparison against the worst word kept so far;
+ * only words that make the cut are copied into the selection, so a full
+ * pass over a large vocabulary allocates O(k) strings.
+ */
+class TopK {
+  private:
+    struct entry_t {
+        std::size_t count;
+        std::string word;
+        const WordInfo *info;
+    };
+
+    /**
+     * Whether `a` ranks before `b`. As a heap comparator this keeps the worst
+     * entry on top.
+     */
+    static auto before(const entry_t &a, const entry_t &b) -> bool {
+        return a.count != b.count ? a.count > b.count : a.word < b.word;
+    }
+
+    std::size_t k;
+    std::vector<entry_t> heap;
+
+  public:
+    /**
+     * @param k The number of words to keep.
+     * @param candidates The number of words that will be offered; `k` comes
+     *        from the user and may be far larger, so only the smaller of the
+     *        two is reserved.
+     */
+    TopK(const std::size_t k, const std::size_t candidates) : k(k) {
+        heap.reserve(std::min(k, candidates));
+    }
+
+    /**
+     * Offers a word to the selection.
+     *
+     * @param word The word; copied only if it is kept.
+     * @param info Its WordInfo; must stay valid until take() is called.
+     */
+    auto offer(const std::string_view word, const WordInfo &info) -> void {
+        if (heap.size() < k) {
+            heap.push_back(entry_t{info.count, std::string(word), &info});
+            std::push_heap(heap.begin(), heap.end(), before);
+            return;
+        }
+        if (!k || info.count < heap.front().count || (info.count == heap.front().count && word >= heap.front().word))
+            return;
+        std::pop_heap(heap.begin(), heap.end(), before);
+        heap.back().count = info.count;
+        heap.back().word.assign(word);
+        heap.back().info = &info;
+        std::push_heap(heap.begin(), heap.end(), before);
+    }
+
+    /**
+     * Returns the kept words, best first.
+     */
+    auto take(void) -> std::vector<std::pair<std::string, WordInfo>> {
+        std::sort_heap(heap.begin(), heap.end(), before);
+        std::vector<std::pair<std::string, WordInfo>> result;
+        result.reserve(heap.size());
+        for (entry_t &entry : heap)
+            result.emplace_back(std::move(entry.word), *entry.info);
+        heap.clear();
+        return result;
+    }
+};
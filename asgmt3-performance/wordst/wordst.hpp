@@ -0,0 +1,26 @@
+#pragma once
+
+/**
+ * The counting library behind wordst_good: tokenizer, readers, exact,
+ * approximate and n-gram engines, index and report, header only. Programs
+ * that hold their text in memory count it with WordCounter; wordst_good.cpp
+ * adds the command line on top.
+ */
+
+#include "approx.hpp"
+#include "arena.hpp"
+#include "corpus.hpp"
+#include "count.hpp"
+#include "hash_table.hpp"
+#include "index.hpp"
+#include "io.hpp"
+#include "json.hpp"
+#include "ngram.hpp"
+#include "report.hpp"
+#include "robin_hood.hpp"
+#include "simd.hpp"
+#include "spill.hpp"
+#include "trie.hpp"
+#include "unicode.hpp"
+#include "word_counter.hpp"
+#include "word_info.hpp"
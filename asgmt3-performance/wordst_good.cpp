@@ -1,349 +1,937 @@
 #include <algorithm>
-#include <array>
-#include <cassert>
 #include <cctype>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <format>
 #include <iostream>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-static constexpr std::size_t buffer_size = 1 << 20;
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-struct FileReader {
-    std::FILE *file;
-    char *buffer;
-    char *p1, *p2;
-    std::size_t line;
+#include "wordst/wordst.hpp"
 
-    /**
-     * Constructor for FileReader.
-     *
-     * @param fp std::FILE to read from.
-     *
-     * Initializes the FileReader object by setting the file pointer, allocating a
-     * buffer and setting the line number to 1. The file pointer is not checked for
-     * validity.
-     */
-    FileReader(std::FILE *fp) {
-        file = fp;
-        buffer = new char[buffer_size];
-        p1 = p2 = buffer;
-        line = 1;
-    }
-
-    /**
-     * Destructor for FileReader.
-     *
-     * Deallocates the buffer allocated in the constructor. The file pointer is not
-     * closed.
-     */
-    ~FileReader(void) {
-        delete[] buffer;
-    }
+/**
+ * Parses a byte count with an optional K, M or G suffix.
+ *
+ * @param arg The argument to parse.
+ * @return The number of bytes, or std::nullopt if `arg` is not a size.
+ */
+static auto parse_size(const char *arg) -> std::optional<size_t> {
+    char *end;
+    const unsigned long long value = std::strtoull(arg, &end, 10);
+    const std::string_view suffix(end);
+    if (end == arg || *arg < '0' || *arg > '9')
+        return std::nullopt;
+    if (suffix.empty())
+        return value;
+    if (suffix == "K" || suffix == "k")
+        return value << 10;
+    if (suffix == "M" || suffix == "m")
+        return value << 20;
+    if (suffix == "G" || suffix == "g")
+        return value << 30;
+    return std::nullopt;
+}
 
-    /**
-     * Gets a character from the file.
-     *
-     * If the current buffer is exhausted, reads a new one from the file.
-     * If the end of the file is reached, returns EOF.
-     *
-     * @return The character read, or EOF if the end of the file is reached.
-     */
-    auto get_char(void) -> char {
-        return (p1 == p2 && (p2 = (p1 = buffer) + fread(buffer, 1, buffer_size, file), p1 == p2) ? EOF : *p1++);
-    }
+struct Options {
+    enum class reader_t { automatic, mmap, buffered, pipelined };
+    enum class engine_t { trie, hash, approx, ngram };
+
+    reader_t reader = reader_t::automatic;
+    engine_t engine = engine_t::trie;
+    bool reserve = false;
+    bool hugepages = false;
+    bool arena_stats = false;
+    bool stats = false;
+    bool utf8 = false;
+    simd::kernel_t kernel = simd::kernel;
+    size_t jobs = 1;
+    std::optional<size_t> top;
+    size_t max_lines = limit;
+    size_t budget = approx_budget;
+    size_t ngram = ngram_length;
+    format_t format = format_t::table;
+    std::optional<size_t> mem_limit;
+    const char *save_index = nullptr;
+    const char *load_index = nullptr;
+    const char *checkpoint = nullptr;
+    std::vector<std::string_view> query;
+    std::vector<const char *> filenames;
+    const char *filename = nullptr;
 
     /**
-     * Extracts and returns the next word from the file.
-     *
-     * Skips non-alphabetic characters until a letter is found, then collects
-     * characters to form a word until a non-alphabetic character is encountered.
-     * Converts the word to lowercase before returning.
-     * Increments the line counter when a newline character is encountered.
+     * Parses the command line.
      *
-     * @return The next word in lowercase, or an empty string if EOF is reached.
+     * @param argc The number of arguments passed to the program.
+     * @param argv The arguments passed to the program.
+     * @return The parsed options, or std::nullopt if the command line is invalid.
      */
-    auto get_word(void) -> std::string {
-        std::string result;
-        char ch = get_char();
-        while (!std::isalpha(ch)) {
-            if (ch == EOF)
-                return "";
-            if (ch == '\n')
-                ++line;
-            ch = get_char();
+    static auto parse(int argc, const char *argv[]) -> std::optional<Options> {
+        Options options;
+        bool trie_given = false, engine_given = false, ngram_given = false, approx_given = false;
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view arg = argv[i];
+            if (arg == "--reader=mmap")
+                options.reader = reader_t::mmap;
+            else if (arg == "--reader=buffered")
+                options.reader = reader_t::buffered;
+            else if (arg == "--reader=pipelined")
+                options.reader = reader_t::pipelined;
+            else if (arg == "--engine=trie")
+                options.engine = engine_t::trie, trie_given = engine_given = true;
+            else if (arg == "--engine=hash")
+                options.engine = engine_t::hash, engine_given = true;
+            else if (arg == "--approx")
+                options.engine = engine_t::approx, approx_given = true;
+            else if (arg.starts_with("--approx=")) {
+                const std::optional<size_t> budget = parse_size(argv[i] + 9);
+                if (!budget || *budget < (size_t{1} << 20))
+                    return std::nullopt;
+                options.engine = engine_t::approx, options.budget = *budget, approx_given = true;
+            } else if (arg == "--mem-limit" && i + 1 < argc) {
+                options.mem_limit = parse_size(argv[++i]);
+                if (!options.mem_limit)
+                    return std::nullopt;
+            } else if (arg == "--ngram" && i + 1 < argc) {
+                const char *value = argv[++i];
+                char *end;
+                options.ngram = std::strtoul(value, &end, 10);
+                if (*value < '0' || *value > '9' || *end || options.ngram < 2 || options.ngram > NgramTable::max_length)
+                    return std::nullopt;
+                options.engine = engine_t::ngram, ngram_given = true;
+            } else if (arg == "--reserve")
+                options.reserve = true;
+            else if (arg == "--hugepages")
+                options.hugepages = true;
+            else if (arg == "--arena-stats")
+                options.arena_stats = true;
+            else if (arg == "--stats=json")
+                options.stats = true;
+            else if (arg == "--format=table")
+                options.format = format_t::table;
+            else if (arg == "--format=json")
+                options.format = format_t::json;
+            else if (arg == "--format=csv")
+                options.format = format_t::csv;
+            else if (arg == "--utf8")
+                options.utf8 = true;
+            else if (arg == "--simd=scalar")
+                options.kernel = simd::kernel_t::scalar;
+            else if (arg == "--simd=sse2" && simd::kernel >= simd::kernel_t::sse2)
+                options.kernel = simd::kernel_t::sse2;
+            else if (arg == "--simd=avx2" && simd::kernel >= simd::kernel_t::avx2)
+                options.kernel = simd::kernel_t::avx2;
+            else if (arg == "--top" && i + 1 < argc) {
+                const char *value = argv[++i];
+                char *end;
+                options.top = std::strtoul(value, &end, 10);
+                if (*value < '0' || *value > '9' || *end)
+                    return std::nullopt;
+            } else if (arg == "--max-lines" && i + 1 < argc) {
+                const char *value = argv[++i];
+                char *end;
+                options.max_lines = std::string_view(value) == "all" ? SIZE_MAX : std::strtoul(value, &end, 10);
+                if (options.max_lines != SIZE_MAX && (*value < '0' || *value > '9' || *end))
+                    return std::nullopt;
+            } else if (arg == "--save-index" && i + 1 < argc)
+                options.save_index = argv[++i];
+            else if (arg == "--load-index" && i + 1 < argc)
+                options.load_index = argv[++i];
+            else if (arg == "--checkpoint" && i + 1 < argc)
+                options.checkpoint = argv[++i];
+            else if (arg == "--query") {
+                while (i + 1 < argc && argv[i + 1][0] != '-')
+                    options.query.emplace_back(argv[++i]);
+                if (options.query.empty())
+                    return std::nullopt;
+            } else if (arg.starts_with("-j")) {
+                const char *value = arg.size() > 2 ? argv[i] + 2 : i + 1 < argc ? argv[++i] : "";
+                char *end;
+                options.jobs = std::strtoul(value, &end, 10);
+                if (*value < '1' || *value > '9' || *end)
+                    return std::nullopt;
+            } else if (arg.starts_with("-"))
+                return std::nullopt;
+            else
+                options.filenames.push_back(argv[i]);
         }
-        while (std::isalpha(ch))
-            result.push_back(ch), ch = get_char();
-        if (ch == '\n')
-            ++line;
-        for (char &c : result)
-            c = std::tolower(c);
-        return result;
+        if ((ngram_given && engine_given) || (approx_given && (engine_given || ngram_given)))
+            return std::nullopt;
+        if (!options.filenames.empty())
+            options.filename = options.filenames[0];
+        if (options.utf8) {
+            if (trie_given || options.load_index)
+                return std::nullopt;
+            if (options.engine == engine_t::trie)
+                options.engine = engine_t::hash;
+        }
+        if (options.load_index ? options.filename || options.save_index : !options.filename || !options.query.empty())
+            return std::nullopt;
+        if ((options.save_index || options.checkpoint) && (options.engine != engine_t::trie || options.filenames.size() > 1))
+            return std::nullopt;
+        if ((options.stats || options.engine == engine_t::approx || options.engine == engine_t::ngram) && options.load_index)
+            return std::nullopt;
+        if (options.mem_limit && (options.engine == engine_t::approx || options.engine == engine_t::ngram || options.jobs > 1 || options.load_index || options.save_index || options.checkpoint))
+            return std::nullopt;
+        return options;
     }
 };
 
-struct FileWriter {
-    std::FILE *file;
-    char *buffer;
-    char *ptr, *end;
+/**
+ * Counters of one run, written to stderr as one JSON object by
+ * `--stats=json`.
+ *
+ * Nothing is measured inside the counting loops: phases are timed at their
+ * boundaries, the engine is surveyed once after counting, the readers keep
+ * the byte and refill counts they need anyway and the rest comes from
+ * getrusage() at exit. Without `--stats` no RunStats exists and each phase
+ * boundary costs one null check.
+ */
+struct RunStats {
+    using clock = std::chrono::steady_clock;
+
+    const char *reader = "mmap";
+    const char *engine = "trie";
+    std::size_t jobs = 1;
+    std::size_t bytes = 0;
+    std::size_t refills = 0;
+    Census census{};
+    MemoryStats memory{};
+    std::vector<std::pair<const char *, double>> phases;
+    clock::time_point start = clock::now();
+    clock::time_point last = start;
 
     /**
-     * Constructs a FileWriter object that writes to the specified file.
-     *
-     * @param fp std::FILE to write to.
+     * Ends a phase, timing it from the end of the previous one.
      *
-     * Initializes the FileWriter object by setting the file pointer, allocating a
-     * buffer and setting the buffer pointers to the beginning of the buffer.
-     * The file pointer is not checked for validity.
+     * @param name The name of the phase, a string literal.
      */
-    FileWriter(std::FILE *fp) {
-        file = fp;
-        buffer = new char[buffer_size];
-        ptr = buffer;
-        end = buffer + buffer_size;
+    auto phase(const char *name) -> void {
+        const clock::time_point now = clock::now();
+        phases.emplace_back(name, std::chrono::duration<double>(now - last).count());
+        last = now;
     }
 
     /**
-     * Destructor for FileWriter.
-     *
-     * Ensures any buffered data is written to the file by calling flush() and
-     * deallocates the buffer memory. This is called automatically when the
-     * FileWriter object goes out of scope.
+     * Records the census and the memory of a complete engine.
      */
-    ~FileWriter(void) {
-        flush();
-        delete[] buffer;
+    template <typename Engine>
+    auto survey(const Engine &counted) -> void {
+        census = counted.census();
+        memory = counted.memory();
     }
 
     /**
-     * Flushes the buffer by writing any buffered data to the file.
-     *
-     * Ensures any data stored in the buffer is written to the file by calling
-     * fwrite() and resets the buffer pointer to the beginning of the buffer.
+     * Writes the counters to stderr as a single line of JSON. Times are in
+     * seconds; the throughput is the input bytes over the "count" phase.
      */
-    auto flush(void) -> void {
-        fwrite(buffer, 1, ptr - buffer, file);
-        ptr = buffer;
-    }
+    auto print(void) const -> void {
+        struct rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+
+        double counting = 0;
+        std::string timings;
+        for (const auto &[name, seconds] : phases) {
+            timings += std::format("{}\"{}\":{:.6f}", timings.empty() ? "" : ",", name, seconds);
+            if (std::string_view(name) == "count")
+                counting = seconds;
+        }
+        const double total = std::chrono::duration<double>(last - start).count();
 
-    /**
-     * Puts a single character into the output stream.
-     *
-     * The character is placed in the buffer. If the buffer is full, it is flushed
-     * automatically.
-     */
-    auto put_char(char ch) -> void {
-        if (ptr == end)
-            flush();
-        *ptr++ = ch;
+        std::cerr
+            << std::format("{{\"reader\":\"{}\",\"engine\":\"{}\",\"jobs\":{},\"bytes\":{},\"refills\":{},", reader, engine, jobs, bytes, refills)
+            << std::format("\"tokens\":{},\"distinct_words\":{},\"nodes\":{},\"engine_bytes\":{},\"posting_bytes\":{},\"copied_bytes\":{},", census.tokens, census.words, census.nodes, memory.reserved, census.postings, memory.copied)
+            << std::format("\"phases\":{{{}}},\"total_seconds\":{:.6f},\"bytes_per_second\":{:.0f},", timings, total, counting > 0 ? bytes / counting : 0.0)
+            << std::format("\"peak_rss_kib\":{},\"minor_faults\":{},\"major_faults\":{},", usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt)
+            << std::format("\"voluntary_context_switches\":{},\"involuntary_context_switches\":{},", usage.ru_nvcsw, usage.ru_nivcsw)
+            << std::format("\"user_seconds\":{:.6f},\"system_seconds\":{:.6f}}}",
+                           usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6, usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6)
+            << std::endl;
     }
+};
 
-    /**
-     * Writes a string to the output stream.
-     *
-     * The string is copied into the buffer and if the buffer is full, it is
-     * flushed automatically.
-     */
-    auto put_string(const std::string &str) -> void {
-        for (size_t i = 0; i < str.length();)
-            if (static_cast<ssize_t>(str.length() - i) >= end - ptr) {
-                std::memcpy(ptr, str.data() + i, end - ptr);
-                flush();
-                i += end - ptr;
-            } else {
-                std::memcpy(ptr, str.data() + i, str.length() - i);
-                ptr += str.length() - i;
-                i = str.length();
+/**
+ * Counts the words of an open file with the given engine.
+ *
+ * Regular files are memory-mapped and tokenized in place, on `options.jobs`
+ * threads if asked to, unless a memory limit is given and no reader is
+ * forced; pipes, character devices, compressed files and files that cannot
+ * be mapped go through the buffered FileReader, or the
+ * PipelinedReader if `--reader=pipelined` was given, which decompress gzip
+ * and zstd input on a thread of their own. The file is closed. With
+ * `options.reserve`, the engine is sized from the file size before counting.
+ * With `options.arena_stats`, the engine's MemoryStats go to stderr.
+ *
+ * @param options The parsed command line.
+ * @param fp The file to count.
+ * @param stats Receives the reader counters and the "count" phase, if not null.
+ * @return The engine holding every word of the file, or std::nullopt after
+ *         printing an error if compressed input could not be decompressed.
+ */
+template <typename Engine>
+static inline auto count_file(const Options &options, std::FILE *fp, RunStats *stats) -> std::optional<Engine> {
+    Engine engine;
+
+    struct stat st;
+    const bool regular = fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+    const bool mappable = regular && !is_compressed(fileno(fp));
+    std::optional<MappedReader> mapped_reader;
+    if (mappable && ((options.reader == Options::reader_t::automatic && !options.mem_limit) || options.reader == Options::reader_t::mmap))
+        mapped_reader.emplace(fileno(fp), st.st_size);
+
+    if (mapped_reader && mapped_reader->valid()) {
+        fclose(fp);
+        bool counted = false;
+        if constexpr (Mergeable<Engine>)
+            if (options.jobs > 1)
+                engine = count_words_parallel<Engine>(mapped_reader->begin, mapped_reader->end, mapped_reader->line, options.jobs, options.reserve), counted = true;
+        if (!counted) {
+            if (options.reserve)
+                engine.reserve(st.st_size);
+            count_words(*mapped_reader, engine);
+        }
+        if (stats)
+            stats->bytes = st.st_size;
+    } else {
+        if (options.reserve && mappable)
+            engine.reserve(st.st_size);
+        bool failed = false;
+        const auto count_stream = [&](auto &&reader, const char *name) {
+            count_words(reader, engine);
+            failed = reader.failed;
+            if (stats) {
+                stats->reader = name;
+                stats->bytes = reader.bytes;
+                stats->refills = reader.refills;
             }
+        };
+        if (options.reader == Options::reader_t::pipelined)
+            count_stream(PipelinedReader(fp), "pipelined");
+        else
+            count_stream(FileReader(fp), "buffered");
+        fclose(fp);
+        if (failed) {
+            std::cerr
+                << std::format("can not decompress file {}", options.filename)
+                << std::endl;
+            return std::nullopt;
+        }
     }
-};
+    if (stats)
+        stats->phase("count");
 
-constexpr std::size_t limit = 20;
-
-struct WordInfo {
-    std::size_t count;
-    std::array<size_t, limit> lines;
-};
+    if (options.arena_stats) {
+        const MemoryStats memory = engine.memory();
+        std::cerr
+            << std::format("arena: {} bytes reserved, {} bytes copied", memory.reserved, memory.copied)
+            << std::endl;
+    }
+    return engine;
+}
 
-class Trie {
-  private:
-    struct unit_t {
-        std::array<size_t, 26> ch;
-        std::optional<WordInfo> info;
+/**
+ * Counts the files of a corpus on a work-stealing pool of `options.jobs`
+ * threads.
+ *
+ * The file indices are dealt out as contiguous ranges, one deque per thread.
+ * A thread takes files from the front of its own deque and, once it is
+ * empty, steals the back half of another thread's deque. Up to
+ * BatchReader::depth consecutive small files (at most 64 KiB each and 1 MiB
+ * together) are read with one BatchReader call; larger files are mapped, and
+ * files that are not regular go through the FileReader. Compressed files of
+ * either size are decompressed through the FileReader.
+ *
+ * Every file is numbered from line 1 with its index packed above, see
+ * Corpus. A thread counts each run of consecutive files into an engine of its
+ * own, so every engine covers a contiguous range of the corpus. The engines
+ * are merged pairwise in corpus order, always folding a later range into an
+ * earlier one, which keeps the recorded lines the first ones in corpus order
+ * whatever the schedule was.
+ *
+ * @param options The parsed command line.
+ * @param corpus The files to count.
+ * @param stats Receives the bytes read and the "count" phase, if not null.
+ * @return The engine holding every word of the corpus, or std::nullopt after
+ *         printing an error for every file that could not be read.
+ */
+template <typename Engine>
+static inline auto count_corpus(const Options &options, const Corpus &corpus, RunStats *stats) -> std::optional<Engine> {
+    static constexpr std::size_t small_file = 64 << 10;
+    struct segment_t {
+        std::size_t first;
+        Engine engine;
+    };
+    struct worker_t {
+        std::mutex lock;
+        std::deque<std::uint32_t> files;
+        std::vector<segment_t> segments;
+        std::vector<std::uint32_t> failed;
+        std::size_t bytes = 0;
+        std::size_t refills = 0;
+        bool uring = false;
     };
-    size_t root;
-    std::vector<unit_t> units;
 
-  public:
-    /**
-     * Constructor for the Trie class.
-     *
-     * Initializes the Trie with a single root node. The root node is
-     * represented by index 0 in the units vector, and the vector is
-     * resized to accommodate this root node.
-     */
-    Trie() {
-        root = 0;
-        units.resize(1);
-    }
+    const std::size_t jobs = options.jobs, count = corpus.names.size();
+    std::vector<worker_t> workers(jobs);
+    for (std::size_t i = 0; i < count; ++i)
+        workers[i * jobs / count].files.push_back(i);
+
+    const auto work = [&](const std::size_t w) {
+        worker_t &self = workers[w];
+        BatchReader batch_reader;
+        self.uring = batch_reader.uring();
+        std::vector<char> buffer;
+        std::vector<BatchReader::request_t> requests;
+        std::vector<std::uint32_t> batch;
+        std::size_t next = SIZE_MAX;
+
+        const auto engine_for = [&](const std::uint32_t id) -> Engine & {
+            if (id != next)
+                self.segments.push_back(segment_t{id, Engine()});
+            next = id + 1;
+            return self.segments.back().engine;
+        };
+        const bool fixed = max_lines == limit;
+        const auto insert = [&](Engine &engine) {
+            return [&engine, fixed](const std::string_view word, const std::size_t line) {
+                if (fixed)
+                    engine.template insert<limit>(word, line);
+                else
+                    engine.insert(word, line);
+            };
+        };
+        const auto first_line = [](const std::uint32_t id) -> std::size_t {
+            return std::size_t{id} << Corpus::line_bits | 1;
+        };
 
-    /**
-     * Inserts a word into the Trie and records its occurrence line.
-     *
-     * Traverses or creates nodes corresponding to each character in the word.
-     * If the word does not exist in the Trie, it creates a path for it.
-     * Once the word is inserted, it updates the WordInfo for the terminal node
-     * to increase the occurrence count and store the line number, if within limits.
-     *
-     * @param word The string to be inserted into the Trie.
-     * @param line The line number where the word occurs.
-     */
-    auto insert(const std::string &word, const size_t line) -> void {
-        size_t p = root;
-        for (char ch : word) {
-            size_t c = ch - 'a';
-            if (!units[p].ch[c]) {
-                units.emplace_back();
-                units[p].ch[c] = units.size() - 1;
+        for (;;) {
+            batch.clear();
+            {
+                std::lock_guard guard(self.lock);
+                std::size_t bytes = 0;
+                while (!self.files.empty() && batch.size() < BatchReader::depth) {
+                    const std::uint32_t id = self.files.front();
+                    const bool small = corpus.sizes[id] <= small_file;
+                    if (!batch.empty() && (!small || bytes + corpus.sizes[id] > buffer_size))
+                        break;
+                    batch.push_back(id);
+                    self.files.pop_front();
+                    bytes += corpus.sizes[id];
+                    if (!small)
+                        break;
+                }
+            }
+            if (batch.empty()) {
+                std::vector<std::uint32_t> stolen;
+                for (std::size_t v = (w + 1) % jobs; v != w && stolen.empty(); v = (v + 1) % jobs) {
+                    std::lock_guard guard(workers[v].lock);
+                    std::deque<std::uint32_t> &files = workers[v].files;
+                    stolen.assign(files.end() - (files.size() + 1) / 2, files.end());
+                    files.erase(files.end() - stolen.size(), files.end());
+                }
+                if (stolen.empty())
+                    break;
+                std::lock_guard guard(self.lock);
+                self.files.insert(self.files.end(), stolen.begin(), stolen.end());
+                continue;
             }
-            p = units[p].ch[c];
-        }
-        if (!units[p].info)
-            units[p].info = WordInfo{0, {}};
-        WordInfo &info = units[p].info.value();
-        ++info.count;
-        if (info.count <= limit)
-            info.lines[info.count - 1] = line;
-    }
 
-    /**
-     * Retrieves all words stored in the Trie along with their associated WordInfo.
-     *
-     * Performs a depth-first search of the Trie to collect all words and their
-     * WordInfo data, including occurrence count and line numbers. Each word is
-     * reconstructed from the path in the Trie and paired with its WordInfo.
-     *
-     * @return A vector of pairs containing each word and its WordInfo.
-     */
-    auto get_all(void) -> std::vector<std::pair<std::string, WordInfo>> {
-        std::vector<std::pair<std::string, WordInfo>> result;
-
-        std::string current;
-        auto search = [&](size_t p, auto &&search) -> void {
-            if (units[p].info) {
-                WordInfo &info = units[p].info.value();
-                result.emplace_back(current, info);
+            if (corpus.sizes[batch[0]] > small_file) {
+                const std::uint32_t id = batch[0];
+                Engine &engine = engine_for(id);
+                const int fd = open(corpus.names[id].c_str(), O_RDONLY);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) != 0) {
+                    if (fd >= 0)
+                        close(fd);
+                    self.failed.push_back(id);
+                    continue;
+                }
+                std::optional<MappedReader> mapped_reader;
+                if (S_ISREG(st.st_mode) && !is_compressed(fd))
+                    mapped_reader.emplace(fd, st.st_size);
+                if (mapped_reader && mapped_reader->valid()) {
+                    close(fd);
+                    mapped_reader->line = first_line(id);
+                    mapped_reader->for_each_word(insert(engine));
+                    self.bytes += st.st_size;
+                } else {
+                    std::FILE *fp = fdopen(fd, "r");
+                    FileReader file_reader(fp);
+                    file_reader.line = first_line(id);
+                    file_reader.for_each_word(insert(engine));
+                    fclose(fp);
+                    if (file_reader.failed)
+                        self.failed.push_back(id);
+                    self.bytes += file_reader.bytes;
+                    self.refills += file_reader.refills;
+                }
+                continue;
+            }
+
+            std::size_t total = 0;
+            requests.clear();
+            for (const std::uint32_t id : batch) {
+                const int fd = open(corpus.names[id].c_str(), O_RDONLY);
+                if (fd < 0)
+                    self.failed.push_back(id);
+                requests.push_back(BatchReader::request_t{fd, nullptr, fd < 0 ? 0 : corpus.sizes[id], 0, 0});
+                total += requests.back().size;
             }
-            for (size_t i = 0; i < 26; ++i)
-                if (units[p].ch[i]) {
-                    current.push_back(i + 'a');
-                    search(units[p].ch[i], search);
-                    current.pop_back();
+            if (buffer.size() < total)
+                buffer.resize(total);
+            for (std::size_t i = 0, offset = 0; i < requests.size(); offset += requests[i++].size)
+                requests[i].buffer = buffer.data() + offset;
+            batch_reader.read(requests.data(), requests.size());
+            ++self.refills;
+
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                const BatchReader::request_t &request = requests[i];
+                if (request.fd < 0)
+                    continue;
+                close(request.fd);
+                if (request.error) {
+                    self.failed.push_back(batch[i]);
+                    continue;
+                }
+                if (detect_compression(reinterpret_cast<const unsigned char *>(request.buffer), request.got) != compression_t::none) {
+                    std::FILE *fp = fmemopen(request.buffer, request.got, "r");
+                    FileReader file_reader(fp);
+                    file_reader.line = first_line(batch[i]);
+                    file_reader.for_each_word(insert(engine_for(batch[i])));
+                    fclose(fp);
+                    if (file_reader.failed)
+                        self.failed.push_back(batch[i]);
+                    self.bytes += file_reader.bytes;
+                    continue;
                 }
+                std::size_t line = first_line(batch[i]);
+                simd::scan_words(request.buffer, request.buffer + request.got, true, line, insert(engine_for(batch[i])));
+                self.bytes += request.got;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t w = 1; w < jobs; ++w)
+        threads.emplace_back(work, w);
+    work(0);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    std::vector<std::uint32_t> failed;
+    std::vector<segment_t> segments;
+    for (worker_t &worker : workers) {
+        failed.insert(failed.end(), worker.failed.begin(), worker.failed.end());
+        for (segment_t &segment : worker.segments)
+            segments.push_back(std::move(segment));
+    }
+    if (!failed.empty()) {
+        std::sort(failed.begin(), failed.end());
+        for (const std::uint32_t id : failed)
+            std::cerr
+                << std::format("can not read file {}", corpus.names[id])
+                << std::endl;
+        return std::nullopt;
+    }
+
+    std::sort(segments.begin(), segments.end(), [](const segment_t &a, const segment_t &b) {
+        return a.first < b.first;
+    });
+    for (std::size_t stride = 1; stride < segments.size(); stride *= 2) {
+        const std::size_t pairs = (segments.size() + 2 * stride - 1) / (2 * stride);
+        const auto fold = [&](const std::size_t t) {
+            for (std::size_t k = t; k < pairs; k += jobs)
+                if (const std::size_t i = 2 * stride * k; i + stride < segments.size())
+                    segments[i].engine.merge(segments[i + stride].engine), segments[i + stride].engine = Engine();
         };
+        threads.clear();
+        for (std::size_t t = 1; t < std::min(jobs, pairs); ++t)
+            threads.emplace_back(fold, t);
+        fold(0);
+        for (std::thread &thread : threads)
+            thread.join();
+    }
 
-        search(root, search);
-        return result;
+    if (stats) {
+        stats->reader = workers[0].uring ? "corpus/io_uring" : "corpus/pread";
+        for (const worker_t &worker : workers) {
+            stats->bytes += worker.bytes;
+            stats->refills += worker.refills;
+        }
+        stats->phase("count");
     }
-};
+    return segments.empty() ? Engine() : std::move(segments[0].engine);
+}
 
 /**
- * Prints the statistics of words stored in a vector of pairs.
+ * Counts a regular file incrementally against a checkpoint.
  *
- * This function takes a vector containing pairs of words and their associated
- * WordInfo, and prints the word statistics in a formatted table. The statistics
- * include the word, its occurrence count, and the line numbers where it appears.
- * The words are sorted by their occurrence count in descending order.
+ * If the checkpoint at `options.checkpoint` was taken of the same file (same
+ * device and inode, not shorter than the checkpointed offset, with the same
+ * 4 KiB before that offset and the same `--max-lines`), its Trie is loaded
+ * and only the bytes after the offset are counted, continuing the line
+ * numbering. Otherwise, for instance after the file was truncated or
+ * rotated, or if the checkpoint is damaged, the whole file is counted.
  *
- * @param wordsVector A vector of pairs, where each pair consists of a word
- *                    (std::string) and its corresponding WordInfo.
- * @details
- * This function first creates an index vector, then divides the words into buckets
- * based on their occurrence counts. The words in each bucket are sorted, and then
- * the words in the buckets are concatenated in descending order of occurrence
- * counts. Finally, the statistics are printed in a formatted table.
+ * A word touching the end of the file may still grow when more text is
+ * appended, so the new checkpoint stops after the last non-letter; that
+ * trailing word is added to the returned Trie only after the checkpoint is
+ * written. Counts and line lists therefore match a full scan of the file.
+ *
+ * @param options The parsed command line.
+ * @param fp The file to count; closed on return.
+ * @param stats Receives the bytes counted and the "count" and "checkpoint"
+ *              phases, if not null.
+ * @return The Trie for the whole file, or std::nullopt after printing an
+ *         error.
  */
-static inline auto printStatis(const std::vector<std::pair<std::string, WordInfo>> &wordsVector) -> void {
-    assert(!wordsVector.empty());
-
-    std::vector<size_t> index(wordsVector.size());
-    std::iota(index.begin(), index.end(), 0);
+static inline auto count_checkpointed(const Options &options, std::FILE *fp, RunStats *stats) -> std::optional<Trie> {
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) {
+        fclose(fp);
+        std::cerr
+            << std::format("can not checkpoint {}: not a regular file", options.filename)
+            << std::endl;
+        return std::nullopt;
+    }
+    if (is_compressed(fileno(fp))) {
+        fclose(fp);
+        std::cerr
+            << std::format("can not checkpoint {}: compressed file", options.filename)
+            << std::endl;
+        return std::nullopt;
+    }
+    const MappedReader reader(fileno(fp), st.st_size);
+    fclose(fp);
+    const char *begin = reader.begin, *end = reader.end;
 
-    constexpr size_t buckets_size = 1e3;
+    Trie trie;
+    std::uint64_t offset = 0;
+    size_t line = 1;
+    {
+        const Index previous(options.checkpoint);
+        if (previous.valid()) {
+            const Index::resume_t resume = previous.resume();
+            if (resume.offset && resume.device == static_cast<std::uint64_t>(st.st_dev) && resume.inode == static_cast<std::uint64_t>(st.st_ino) &&
+                resume.offset <= static_cast<std::uint64_t>(end - begin) && resume.fingerprint == Index::fingerprint(begin, resume.offset) &&
+                previous.max_lines() == max_lines) {
+                if (std::optional<Trie> loaded = previous.to_trie()) {
+                    trie = std::move(*loaded);
+                    offset = resume.offset;
+                    line = resume.line;
+                }
+            }
+        }
+    }
 
-    std::vector<std::vector<size_t>> buckets(buckets_size);
-    std::vector<size_t> residual;
-    for (const auto i : index) {
-        const WordInfo &info = wordsVector[i].second;
-        if (info.count < buckets_size)
-            buckets[info.count].push_back(i);
+    const char *safe = end;
+    while (safe != begin + offset && simd::is_letter(safe[-1]))
+        --safe;
+    if (safe != begin + offset) {
+        Trie appended = count_words_parallel<Trie>(begin + offset, safe, line, options.jobs, options.reserve);
+        if (offset)
+            trie.merge(appended);
         else
-            residual.push_back(i);
+            trie = std::move(appended);
     }
 
-    std::sort(residual.begin(), residual.end(), [&](const size_t a, const size_t b) -> bool {
-        return wordsVector[a].second.count > wordsVector[b].second.count;
-    });
-
-    std::vector<size_t> result;
-    result.insert(result.end(), residual.begin(), residual.end());
-    for (size_t i = buckets_size - 1; i < buckets_size; --i)
-        result.insert(result.end(), buckets[i].begin(), buckets[i].end());
+    if (stats) {
+        stats->bytes = end - (begin + offset);
+        stats->phase("count");
+    }
 
-    FileWriter writer(stdout);
+    const Index::resume_t resume{
+        static_cast<std::uint64_t>(st.st_dev), static_cast<std::uint64_t>(st.st_ino),
+        static_cast<std::uint64_t>(safe - begin), line, Index::fingerprint(begin, safe - begin)};
+    if (!Index::save(trie, options.checkpoint, resume)) {
+        std::cerr
+            << std::format("can not write checkpoint {}", options.checkpoint)
+            << std::endl;
+        return std::nullopt;
+    }
+    if (stats)
+        stats->phase("checkpoint");
 
-    writer.put_string(std::format("WORD                 COUNT APPEARS-LINES\n"));
-    for (const auto i : result) {
-        const auto &p = wordsVector[i];
-        const std::string &word = p.first;
-        const WordInfo &info = p.second;
+    if (safe != end)
+        trie.insert(std::string_view(safe, end - safe), line);
+    return trie;
+}
 
-        writer.put_string(std::format("{:<20} {:<5} ", word.data(), info.count));
-        writer.put_string(std::format("{}", info.lines.front()));
-        for (size_t j = 1; j < std::min(info.lines.size(), info.count); ++j)
-            writer.put_string(std::format(",{}", info.lines[j]));
+/**
+ * Answers `--top K` or `--query word...` from an index file, or prints all
+ * words in rank order if neither is given. Queried words are printed in the
+ * order given, lowercased, with a count of 0 if the index does not hold them.
+ *
+ * @param options The parsed command line.
+ * @return 0 on success, 1 if the index cannot be opened or is malformed.
+ */
+static inline auto query_index(const Options &options) -> int {
+    const Index index(options.load_index);
+    const auto invalid = [&] {
+        std::cerr
+            << std::format("can not open index {}: invalid index", options.load_index)
+            << std::endl;
+        return 1;
+    };
+    if (!index.valid())
+        return invalid();
+
+    std::vector<std::pair<std::string, WordInfo>> words;
+    if (options.query.empty()) {
+        std::optional<std::vector<std::pair<std::string, WordInfo>>> top = index.get_top(options.top.value_or(SIZE_MAX));
+        if (!top)
+            return invalid();
+        words = std::move(*top);
+    } else
+        for (const std::string_view word : options.query) {
+            const std::optional<WordInfo> info = index.find(word);
+            if (!info)
+                return invalid();
+            std::string lower(word);
+            for (char &c : lower)
+                c = std::tolower(static_cast<unsigned char>(c));
+            words.emplace_back(std::move(lower), *info);
+        }
 
-        writer.put_char('\n');
-    }
+    std::vector<size_t> order(words.size());
+    std::iota(order.begin(), order.end(), 0);
+    printTable(words, order);
+    return 0;
 }
 
+static constexpr const char *usage =
+    "Usage: {0} [options] filename...\n"
+    "       {0} --load-index index [--top K | --query word...]\n"
+    "Options:\n"
+    "  --reader=mmap|buffered|pipelined\n"
+    "                            input path, mmap by default for regular files\n"
+    "  --engine=trie|hash        counting engine, trie by default\n"
+    "  --approx[=SIZE]           count the most frequent words approximately\n"
+    "                            in SIZE bytes (K, M or G suffix), 64M by default,\n"
+    "                            not with --engine or --ngram\n"
+    "  --mem-limit SIZE          spill sorted runs to $TMPDIR to stay within SIZE,\n"
+    "                            at least 16M\n"
+    "  --ngram N                 count runs of N consecutive words, N from 2 to 8,\n"
+    "                            with an engine of its own, not with --engine\n"
+    "  --simd=avx2|sse2|scalar   tokenizer kernel, the widest supported by default\n"
+    "  --utf8                    count UTF-8 words with Unicode case folding\n"
+    "  -j N                      count a mapped file or a corpus on N threads\n"
+    "  --top K                   print only the K most frequent words\n"
+    "  --max-lines N|all         lines to list per word, 20 by default\n"
+    "  --format=table|json|csv   output format, the fixed-width table by default\n"
+    "  --reserve                 size the engine from the file size\n"
+    "  --hugepages               back the engine with transparent hugepages\n"
+    "  --arena-stats             report engine memory to stderr\n"
+    "  --stats=json              report run counters to stderr as JSON\n"
+    "  --save-index index        also save the counted trie to an index file\n"
+    "  --checkpoint file         count only what was appended since the last run";
+
 /**
  * The main entry point of the program.
  *
- * This function takes a filename as its argument, reads the file line by line,
- * and inserts each word into a Trie. The line number of each word is stored
- * in the Trie. Finally, the word statistics are printed in a formatted table.
+ * Reads the input, tokenizes it into words, counts them with an engine,
+ * ranks them by count and reports them. The input is a file, mapped or
+ * streamed by a reader, or a corpus of files. The engine is a Trie or
+ * another engine that the options pick, and the report is a table, JSON or
+ * CSV. With an index, the reading and counting are skipped. See Options and
+ * `usage` for the flags, and count_file() and count_corpus() for how the
+ * input is read.
  *
  * @param argc The number of arguments passed to the program.
  * @param argv The array of arguments passed to the program. The first element
- *             is the program name, and the second element is the filename.
+ *             is the program name, and the last ones are the files to count.
  * @return 0 if the program runs successfully, 1 otherwise.
  */
 int main(int argc, const char *argv[]) {
-    if (argc != 2) {
+    const std::optional<Options> options = Options::parse(argc, argv);
+    if (!options) {
         std::cerr
-            << std::format("Usage: {} filename", argv[0])
+            << std::format(usage, argv[0])
             << std::endl;
         return 1;
     }
 
-    std::FILE *fp = fopen(argv[1], "r");
-    FileReader file_reader(fp);
+    report_format = options->format;
+    if (options->load_index)
+        return query_index(*options);
 
-    Trie trie;
+    std::error_code error;
+    const bool corpus_mode = options->filenames.size() > 1 || std::filesystem::is_directory(options->filename, error);
+    if (corpus_mode && (options->save_index || options->checkpoint)) {
+        std::cerr
+            << std::format("can not save an index of directory {}", options->filename)
+            << std::endl;
+        return 1;
+    }
+    if (corpus_mode && options->engine == Options::engine_t::approx) {
+        std::cerr
+            << std::format("can not count directory {} approximately", options->filename)
+            << std::endl;
+        return 1;
+    }
+    if (corpus_mode && options->engine == Options::engine_t::ngram) {
+        std::cerr
+            << std::format("can not count n-grams of directory {}", options->filename)
+            << std::endl;
+        return 1;
+    }
+    if (options->mem_limit && *options->mem_limit < (size_t{16} << 20)) {
+        std::cerr
+            << std::format("can not count in less than 16M of memory")
+            << std::endl;
+        return 1;
+    }
+    if (corpus_mode && options->mem_limit) {
+        std::cerr
+            << std::format("can not count directory {} with a memory limit", options->filename)
+            << std::endl;
+        return 1;
+    }
 
-    std::string word;
-    while (word = file_reader.get_word(), word.length())
-        trie.insert(word, file_reader.line);
-    fclose(fp);
+    simd::kernel = options->kernel;
+    simd::utf8 = options->utf8;
+    arena_hugepages = options->hugepages;
+    max_lines = options->max_lines;
+    approx_budget = options->budget / options->jobs;
+    ngram_length = options->ngram;
+    mem_limit = options->mem_limit.value_or(SIZE_MAX);
+
+    std::optional<RunStats> stats;
+    if (options->stats) {
+        stats.emplace();
+        if (options->engine == Options::engine_t::approx)
+            stats->engine = options->utf8 ? "utf8/approx" : "approx";
+        else if (options->engine == Options::engine_t::ngram)
+            stats->engine = options->utf8 ? "utf8/ngram" : "ngram";
+        else
+            stats->engine = options->utf8 ? "utf8/hash" : options->engine == Options::engine_t::hash ? "hash" : "trie";
+        stats->jobs = options->jobs;
+    }
+    RunStats *const tracker = stats ? &*stats : nullptr;
+    std::optional<Corpus> corpus;
+
+    const auto report = [&](auto &&engine) {
+        const Corpus *files = corpus ? &*corpus : nullptr;
+        if (options->top) {
+            const auto words = engine.get_top(*options->top);
+            if (stats)
+                stats->phase("collect");
+            std::vector<size_t> order(words.size());
+            std::iota(order.begin(), order.end(), 0);
+            printTable(words, order, stdout, files);
+        } else {
+            const auto words = engine.get_all();
+            if (stats)
+                stats->phase("collect");
+            printStatis(words, files, options->jobs);
+        }
+        if (stats) {
+            stats->phase("report");
+            stats->survey(engine);
+            stats->print();
+        }
+    };
+
+    if (corpus_mode) {
+        corpus = Corpus::collect(options->filenames);
+        if (!corpus)
+            return 1;
+        const auto count = [&]<typename Engine>(std::type_identity<Engine>) -> int {
+            const std::optional<Engine> counted = count_corpus<Engine>(*options, *corpus, tracker);
+            if (!counted)
+                return 1;
+            report(*counted);
+            return 0;
+        };
+        if (options->engine == Options::engine_t::trie)
+            return count(std::type_identity<Trie>{});
+        return options->utf8 ? count(std::type_identity<Utf8HashTable>{}) : count(std::type_identity<HashTable>{});
+    }
+
+    std::FILE *fp = fopen(options->filename, "r");
+    if (!fp) {
+        std::cerr
+            << std::format("can not open file {}", options->filename)
+            << std::endl;
+        return 1;
+    }
 
-    printStatis(trie.get_all());
+    if (options->mem_limit) {
+        const auto count = [&]<typename Engine>(std::type_identity<Engine>) -> int {
+            std::optional<Spilling<Engine>> spilling = count_file<Spilling<Engine>>(*options, fp, tracker);
+            if (!spilling)
+                return 1;
+            Spilling<Engine> &counted = *spilling;
+            if (!counted.spilled() && counted.ok()) {
+                report(counted.engine());
+                return 0;
+            }
+            if (stats)
+                stats->survey(counted.engine());
+            if (!counted.print(stdout, options->top.value_or(SIZE_MAX))) {
+                const char *dir = std::getenv("TMPDIR");
+                std::cerr
+                    << std::format("can not spill to {}", dir && *dir ? dir : "/tmp")
+                    << std::endl;
+                return 1;
+            }
+            if (stats) {
+                stats->phase("report");
+                stats->print();
+            }
+            return 0;
+        };
+        if (options->engine == Options::engine_t::trie)
+            return count(std::type_identity<Trie>{});
+        return options->utf8 ? count(std::type_identity<Utf8HashTable>{}) : count(std::type_identity<HashTable>{});
+    }
+
+    const auto count = [&]<typename Engine>(std::type_identity<Engine>) -> int {
+        const std::optional<Engine> counted = count_file<Engine>(*options, fp, tracker);
+        if (!counted)
+            return 1;
+        report(*counted);
+        return 0;
+    };
+    if (options->engine == Options::engine_t::approx)
+        return options->utf8 ? count(std::type_identity<Utf8HeavyHitters>{}) : count(std::type_identity<HeavyHitters>{});
+    if (options->engine == Options::engine_t::ngram)
+        return options->utf8 ? count(std::type_identity<Utf8NgramTable>{}) : count(std::type_identity<NgramTable>{});
+    if (options->engine == Options::engine_t::hash)
+        return options->utf8 ? count(std::type_identity<Utf8HashTable>{}) : count(std::type_identity<HashTable>{});
+
+    std::optional<Trie> counted = options->checkpoint ? count_checkpointed(*options, fp, tracker) : count_file<Trie>(*options, fp, tracker);
+    if (!counted)
+        return 1;
+    const Trie &trie = *counted;
+    if (options->save_index) {
+        if (!Index::save(trie, options->save_index)) {
+            std::cerr
+                << std::format("can not write index {}", options->save_index)
+                << std::endl;
+            return 1;
+        }
+        if (stats)
+            stats->phase("index");
+    }
+    report(trie);
     return 0;
 }